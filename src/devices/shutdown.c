@@ -8,6 +8,7 @@
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/pagedir.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
@@ -127,5 +128,6 @@ print_stats (void)
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  pagedir_print_stats ();
 #endif
 }
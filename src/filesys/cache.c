@@ -0,0 +1,424 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of sectors in the cache. */
+#define CACHE_SIZE 64
+
+/* Time between writes of dirty sectors behind the writers' backs,
+   in timer ticks. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Most sectors waiting to be read ahead.  More requests are
+   dropped. */
+#define READ_AHEAD_MAX 16
+
+/* Sector of an unused cache entry. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, or NO_SECTOR. */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int users;                          /* Threads using it; >0: not reused. */
+    bool logged;                        /* Changed and not committed? */
+    unsigned batch;                     /* Batch it was last logged in. */
+    struct lock lock;                   /* Held while DATA is in use. */
+    bool dirty;                         /* Changed since read?  Under LOCK. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Guards the SECTOR, ACCESSED and USERS members of every entry,
+   and the clock hand.  LOGGED is set with both cache_lock and the
+   entry's lock held, and cleared under cache_lock.  A logged
+   entry is neither written back nor reused: its sector may only
+   reach the disk once the journal has committed it. */
+static struct lock cache_lock;
+static int hand;
+static size_t logged_cnt;
+
+/* Batch that sectors logged now belong to.  Each snapshot starts
+   the next one, so that operations may log while the journal
+   commits the last. */
+static unsigned batch;
+
+/* Sectors to read ahead, in a ring. */
+static block_sector_t ahead[READ_AHEAD_MAX];
+static int ahead_first, ahead_cnt;
+static struct lock ahead_lock;
+static struct condition ahead_cond;
+
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_victim (void);
+static thread_func flush_daemon NO_RETURN;
+static thread_func read_ahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache and starts its write-behind and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  int i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].sector = NO_SECTOR;
+      cache[i].accessed = false;
+      cache[i].users = 0;
+      cache[i].logged = false;
+      cache[i].batch = 0;
+      cache[i].dirty = false;
+      lock_init (&cache[i].lock);
+    }
+  lock_init (&cache_lock);
+  lock_init (&ahead_lock);
+  cond_init (&ahead_cond);
+
+  thread_create ("cache-flush", PRI_DEFAULT, flush_daemon, NULL);
+  thread_create ("cache-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR.  The
+   write reaches the disk later, from cache_flush() or when the
+   sector is evicted. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* A whole sector need not be read first. */
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR, like
+   cache_write_at(), as a change to file system metadata: the
+   sector is held in the cache until the journal commits it.  The
+   journal only lets operations start while there is room for all
+   they may log, so at most CACHE_LOG_MAX sectors are logged. */
+void
+cache_log_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  lock_acquire (&cache_lock);
+  if (!e->logged)
+    {
+      ASSERT (logged_cnt < CACHE_LOG_MAX);
+      e->logged = true;
+      logged_cnt++;
+    }
+  e->batch = batch;
+  lock_release (&cache_lock);
+  cache_put (e);
+}
+
+/* Asks for SECTOR to be brought into the cache in the
+   background, as it is likely to be read soon. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&ahead_lock);
+  if (ahead_cnt < READ_AHEAD_MAX)
+    {
+      ahead[(ahead_first + ahead_cnt++) % READ_AHEAD_MAX] = sector;
+      cond_signal (&ahead_cond, &ahead_lock);
+    }
+  lock_release (&ahead_lock);
+}
+
+/* Writes every dirty sector to disk, except those logged. */
+void
+cache_flush (void)
+{
+  struct cache_entry *e;
+
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    {
+      lock_acquire (&cache_lock);
+      if (e->sector == NO_SECTOR || e->logged)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->users++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (e->dirty && !e->logged)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+        }
+      cache_put (e);
+    }
+}
+
+/* Writes SECTOR to disk if it is cached, dirty and not logged.
+   Returns false if it is logged, so that its home is not up to
+   date. */
+bool
+cache_write_back (block_sector_t sector)
+{
+  struct cache_entry *e;
+  bool written = true;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  if (e == NULL || e->logged)
+    {
+      lock_release (&cache_lock);
+      return e == NULL;
+    }
+  e->users++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (e->logged)
+    written = false;
+  else if (e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+    }
+  cache_put (e);
+  return written;
+}
+
+/* Returns the number of sectors logged. */
+size_t
+cache_logged_cnt (void)
+{
+  size_t cnt;
+
+  lock_acquire (&cache_lock);
+  cnt = logged_cnt;
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Copies every logged sector into DATA, and its number into
+   SECTORS, in the same order, and starts the next batch.  Returns
+   how many there are, at most CACHE_LOG_MAX.  Nothing may log a
+   sector meanwhile. */
+size_t
+cache_snapshot (block_sector_t *sectors, void *data_)
+{
+  uint8_t *data = data_;
+  struct cache_entry *e;
+  size_t cnt = 0;
+
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    {
+      lock_acquire (&cache_lock);
+      if (!e->logged)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->users++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      sectors[cnt] = e->sector;
+      memcpy (data + cnt++ * BLOCK_SECTOR_SIZE, e->data, BLOCK_SECTOR_SIZE);
+      cache_put (e);
+    }
+
+  lock_acquire (&cache_lock);
+  batch++;
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Lets the sectors in the last snapshot be written back like any
+   other, once the journal has committed them.  Those logged again
+   since belong to the next batch and stay logged. */
+void
+cache_unlog (void)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    if (e->logged && e->batch != batch)
+      {
+        e->logged = false;
+        logged_cnt--;
+      }
+  lock_release (&cache_lock);
+}
+
+/* Returns the entry for SECTOR with its lock held, reading the
+   sector from disk first if it was not cached and LOAD is true.
+   Must be followed by cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          /* Whoever is loading or using it has its lock. */
+          e->users++;
+          e->accessed = true;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      e = cache_victim ();
+      if (e == NULL)
+        {
+          /* Every entry is in use. */
+          lock_release (&cache_lock);
+          thread_yield ();
+          lock_acquire (&cache_lock);
+          continue;
+        }
+      if (!e->dirty)
+        break;
+
+      /* Write the victim back while it still holds its old sector,
+         so that nobody can read that sector from disk in the
+         meantime.  It may have been logged in the meantime too.
+         By then SECTOR may have been cached by someone else, so
+         look again. */
+      e->users++;
+      lock_release (&cache_lock);
+      lock_acquire (&e->lock);
+      if (!e->logged)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+        }
+      cache_put (e);
+      lock_acquire (&cache_lock);
+    }
+
+  /* Nobody uses the victim, so its lock is free.  Take it before
+     anyone can find the entry under its new sector. */
+  e->sector = sector;
+  e->accessed = true;
+  e->users = 1;
+  lock_acquire (&e->lock);
+  lock_release (&cache_lock);
+
+  if (load)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Releases entry E obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  e->users--;
+  lock_release (&cache_lock);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer.  The caller
+   must hold cache_lock. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    if (e->sector == sector)
+      return e;
+  return NULL;
+}
+
+/* Chooses an entry nobody is using to hold another sector, by the
+   clock algorithm: unused entries first, then ones not accessed
+   since the hand last passed them.  Logged entries are in use.
+   Returns a null pointer if every entry is in use.  The caller must hold cache_lock. */
+static struct cache_entry *
+cache_victim (void)
+{
+  struct cache_entry *e;
+  int i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      e = &cache[hand];
+      hand = (hand + 1) % CACHE_SIZE;
+      if (e->users > 0 || e->logged)
+        continue;
+      if (e->sector == NO_SECTOR || !e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+/* Writes dirty sectors behind every FLUSH_INTERVAL, so that a
+   crash loses little. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Brings the sectors queued by cache_read_ahead() into the
+   cache. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  block_sector_t sector;
+
+  for (;;)
+    {
+      lock_acquire (&ahead_lock);
+      while (ahead_cnt == 0)
+        cond_wait (&ahead_cond, &ahead_lock);
+      sector = ahead[ahead_first];
+      ahead_first = (ahead_first + 1) % READ_AHEAD_MAX;
+      ahead_cnt--;
+      lock_release (&ahead_lock);
+
+      cache_put (cache_get (sector, true));
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Most sectors logged for the journal at once.  They stay in the
+   cache until committed, so this leaves room for other sectors. */
+#define CACHE_LOG_MAX 48
+
+void cache_init (void);
+void cache_read_at (block_sector_t, void *, int ofs, int size);
+void cache_write_at (block_sector_t, const void *, int ofs, int size);
+void cache_log_at (block_sector_t, const void *, int ofs, int size);
+void cache_read_ahead (block_sector_t);
+void cache_flush (void);
+bool cache_write_back (block_sector_t);
+size_t cache_logged_cnt (void);
+size_t cache_snapshot (block_sector_t *, void *);
+void cache_unlog (void);
+
+#endif /* filesys/cache.h */
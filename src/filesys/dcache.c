@@ -0,0 +1,136 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Most names cached.  The least recently used goes first. */
+#define DCACHE_SIZE 256
+
+/* What a directory holds under a name: an inode sector, or
+   DCACHE_ABSENT. */
+struct dentry
+  {
+    block_sector_t dir;                 /* Inode sector of the directory. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t sector;              /* Inode sector of the file. */
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru, newest first. */
+  };
+
+static struct hash dentries;
+static struct list lru;
+static size_t dentry_cnt;
+
+/* Guards all of the above. */
+static struct lock dcache_lock;
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+static struct dentry *dentry_find (block_sector_t dir, const char *name);
+
+/* Initializes the name cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in directory DIR.  Returns true and stores the
+   file's inode sector, or DCACHE_ABSENT, into *SECTORP if the
+   cache knows; otherwise returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru, &d->lru_elem);
+      *sectorp = d->sector;
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that directory DIR holds SECTOR under NAME, or nothing
+   if SECTOR is DCACHE_ABSENT.  The directory code calls this for
+   every lookup, addition and removal, so that the cache never
+   disagrees with the disk. */
+void
+dcache_set (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  ASSERT (strlen (name) <= NAME_MAX);
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      if (dentry_cnt < DCACHE_SIZE && (d = malloc (sizeof *d)) != NULL)
+        dentry_cnt++;
+      else if (!list_empty (&lru))
+        {
+          /* Reuse the least recently used. */
+          d = list_entry (list_pop_back (&lru), struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+        }
+      else
+        {
+          lock_release (&dcache_lock);
+          return;
+        }
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_push_front (&lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer.  The
+   caller must hold dcache_lock. */
+static struct dentry *
+dentry_find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Hashes a dentry by its directory and name. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Orders dentries by directory, then name. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -0,0 +1,16 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Inode sector of a name known not to exist.  Sector 0 holds the
+   free map, which no directory lists. */
+#define DCACHE_ABSENT 0
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sectorp);
+void dcache_set (block_sector_t dir, const char *name, block_sector_t);
+
+#endif /* filesys/dcache.h */
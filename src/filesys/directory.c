@@ -1,38 +1,165 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* A directory is a hash table on disk, by extendible hashing.
+   The directory file starts with a header and an index of
+   1 << DEPTH slots.  The low DEPTH bits of a name's hash pick a
+   slot, which holds the sector of the bucket the name is in,
+   counting from the start of the file.  A bucket takes a sector.
+   A full bucket splits in two on the next bit of the hash, and
+   the index doubles if the bucket already had all DEPTH bits to
+   itself.  Looking up a name thus reads the header, one index
+   sector and one bucket, however big the directory. */
+
+/* Identifies a directory. */
+#define DIR_MAGIC 0x44495248
+
+/* Entries in a bucket. */
+#define BUCKET_ENTRIES 24
+
+/* Most hash bits the index may use.  Adding a name may split its
+   bucket once per bit and double the index along the way, which
+   must stay within DIR_LOG_MAX sectors. */
+#define DIR_MAX_DEPTH 8
+
 /* A directory. */
-struct dir 
+struct dir
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
   };
 
+/* Start of a directory file, followed by the index. */
+struct dir_header
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t depth;                     /* Hash bits the index uses. */
+    uint32_t entry_cnt;                 /* Entries in all buckets. */
+    block_sector_t parent;              /* Inode sector of "..". */
+  };
+
 /* A single directory entry. */
-struct dir_entry 
+struct dir_entry
   {
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A bucket of entries.  Must be exactly BLOCK_SECTOR_SIZE bytes
+   long; all zeros is an empty bucket. */
+struct dir_bucket
+  {
+    uint32_t depth;                     /* Hash bits its names share. */
+    uint32_t cnt;                       /* Entries in use, first. */
+    struct dir_entry entries[BUCKET_ENTRIES];
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8
+                   - BUCKET_ENTRIES * sizeof (struct dir_entry)];
+  };
+
+/* Returns the number of sectors the header and an index of
+   1 << DEPTH slots take up.  Buckets come after them. */
+static off_t
+index_sectors (uint32_t depth)
+{
+  return DIV_ROUND_UP (sizeof (struct dir_header)
+                       + (sizeof (block_sector_t) << depth),
+                       BLOCK_SECTOR_SIZE);
+}
+
+static void
+read_header (struct inode *inode, struct dir_header *h)
+{
+  inode_read_at (inode, h, sizeof *h, 0);
+}
+
+static void
+write_header (struct inode *inode, const struct dir_header *h)
+{
+  inode_write_at (inode, h, sizeof *h, 0);
+}
+
+/* Returns the bucket sector in index slot SLOT. */
+static block_sector_t
+slot_get (struct inode *inode, uint32_t slot)
+{
+  block_sector_t bucket;
+
+  inode_read_at (inode, &bucket, sizeof bucket,
+                 sizeof (struct dir_header) + slot * sizeof bucket);
+  return bucket;
+}
+
+/* Points index slot SLOT to BUCKET. */
+static void
+slot_put (struct inode *inode, uint32_t slot, block_sector_t bucket)
+{
+  inode_write_at (inode, &bucket, sizeof bucket,
+                  sizeof (struct dir_header) + slot * sizeof bucket);
+}
+
+static void
+read_bucket (struct inode *inode, block_sector_t sector,
+             struct dir_bucket *b)
+{
+  inode_read_at (inode, b, sizeof *b, sector * BLOCK_SECTOR_SIZE);
+}
+
+/* Writes B to SECTOR of the directory file, which may extend it.
+   Returns false if the disk is full. */
+static bool
+write_bucket (struct inode *inode, block_sector_t sector,
+              const struct dir_bucket *b)
+{
+  return inode_write_at (inode, b, sizeof *b, sector * BLOCK_SECTOR_SIZE)
+         == sizeof *b;
+}
+
+/* Creates a directory in the given SECTOR, with PARENT as its
+   parent directory.  Returns true if successful, false on
+   failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct inode *inode;
+
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  /* The whole index, the buckets moved out of its way, a new
+     bucket per split and the one split first, and the inode. */
+  ASSERT (2 * index_sectors (DIR_MAX_DEPTH) + DIR_MAX_DEPTH + INODE_LOG_MAX
+          <= DIR_LOG_MAX);
+
+  /* The header and index, then one empty bucket. */
+  if (!inode_create (sector, (index_sectors (0) + 1) * BLOCK_SECTOR_SIZE,
+                     true))
+    return false;
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+
+  h.magic = DIR_MAGIC;
+  h.depth = 0;
+  h.entry_cnt = 0;
+  h.parent = parent;
+  write_header (inode, &h);
+  slot_put (inode, 0, index_sectors (0));
+  inode_close (inode);
+  return true;
 }
 
 /* Opens and returns the directory for the given INODE, of which
    it takes ownership.  Returns a null pointer on failure. */
 struct dir *
-dir_open (struct inode *inode) 
+dir_open (struct inode *inode)
 {
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
@@ -45,7 +172,7 @@ dir_open (struct inode *inode)
     {
       inode_close (inode);
       free (dir);
-      return NULL; 
+      return NULL;
     }
 }
 
@@ -60,14 +187,14 @@ dir_open_root (void)
 /* Opens and returns a new directory for the same inode as DIR.
    Returns a null pointer on failure. */
 struct dir *
-dir_reopen (struct dir *dir) 
+dir_reopen (struct dir *dir)
 {
   return dir_open (inode_reopen (dir->inode));
 }
 
 /* Destroys DIR and frees associated resources. */
 void
-dir_close (struct dir *dir) 
+dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
@@ -78,122 +205,273 @@ dir_close (struct dir *dir)
 
 /* Returns the inode encapsulated by DIR. */
 struct inode *
-dir_get_inode (struct dir *dir) 
+dir_get_inode (struct dir *dir)
 {
   return dir->inode;
 }
 
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   if EP is non-null, and sets *BUCKETP and *IDXP to the sector of
+   its bucket and its index there if BUCKETP is non-null.
+   otherwise, returns false and ignores EP, BUCKETP and IDXP. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        struct dir_entry *ep, block_sector_t *bucketp, uint32_t *idxp)
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  struct dir_header h;
+  struct dir_bucket b;
+  block_sector_t bucket;
+  uint32_t i;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
+  read_header (dir->inode, &h);
+  bucket = slot_get (dir->inode, hash_string (name) & ((1u << h.depth) - 1));
+  read_bucket (dir->inode, bucket, &b);
+  for (i = 0; i < b.cnt; i++)
+    if (!strcmp (name, b.entries[i].name))
       {
         if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
+          *ep = b.entries[i];
+        if (bucketp != NULL)
+          {
+            *bucketp = bucket;
+            *idxp = i;
+          }
         return true;
       }
   return false;
 }
 
+/* Returns the inode sector of the file named NAME in DIR, or
+   DCACHE_ABSENT, asking the name cache first and telling it what
+   the directory holds otherwise. */
+static block_sector_t
+find (const struct dir *dir, const char *name)
+{
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  block_sector_t sector;
+  struct dir_entry e;
+
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL, NULL)
+               ? e.inode_sector : DCACHE_ABSENT;
+      if (strlen (name) <= NAME_MAX)
+        dcache_set (dir_sector, name, sector);
+    }
+  return sector;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   "." and ".." name DIR and its parent.  A removed directory has
+   no entries. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
-            struct inode **inode) 
+            struct inode **inode)
 {
-  struct dir_entry e;
+  block_sector_t sector;
+  struct dir_header h;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  inode_lock_dir (dir->inode);
+  if (inode_is_removed (dir->inode))
+    *inode = NULL;
+  else if (!strcmp (name, "."))
+    *inode = inode_reopen (dir->inode);
+  else if (!strcmp (name, ".."))
+    {
+      read_header (dir->inode, &h);
+      *inode = inode_open (h.parent);
+    }
+  else if ((sector = find (dir, name)) != DCACHE_ABSENT)
+    *inode = inode_open (sector);
   else
     *inode = NULL;
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
 
+/* Doubles the index of directory INODE, whose header is *H.
+   Buckets in the way of the bigger index move to the end of the
+   file first.  Returns false if the disk is full, leaving the
+   directory as it was. */
+static bool
+index_double (struct inode *inode, struct dir_header *h, struct dir_bucket *b)
+{
+  uint32_t slots = 1u << h->depth;
+  block_sector_t length = inode_length (inode) / BLOCK_SECTOR_SIZE;
+  block_sector_t index_end = index_sectors (h->depth + 1);
+  block_sector_t end = length > index_end ? length : index_end;
+  block_sector_t sector;
+  uint32_t i;
+
+  for (sector = index_sectors (h->depth);
+       sector < index_end && sector < length; sector++)
+    {
+      read_bucket (inode, sector, b);
+      if (!write_bucket (inode, end, b))
+        return false;
+      for (i = 0; i < slots; i++)
+        if (slot_get (inode, i) == sector)
+          slot_put (inode, i, end);
+      end++;
+    }
+
+  /* Every bucket is past the index by now, so the new slots lie
+     within the file. */
+  for (i = 0; i < slots; i++)
+    slot_put (inode, slots + i, slot_get (inode, i));
+  h->depth++;
+  write_header (inode, h);
+  return true;
+}
+
+/* Splits full bucket B, in SECTOR of directory INODE and found
+   through index slot SLOT, on the next bit of its names' hashes.
+   Returns false if the index can grow no more or the disk is
+   full.  B is clobbered either way. */
+static bool
+bucket_split (struct inode *inode, struct dir_header *h, uint32_t slot,
+              block_sector_t sector, struct dir_bucket *b)
+{
+  struct dir_bucket *nb;
+  block_sector_t new_sector;
+  uint32_t bit, i;
+  bool success = false;
+
+  nb = malloc (sizeof *nb);
+  if (nb == NULL)
+    return false;
+
+  if (b->depth == h->depth)
+    {
+      if (h->depth == DIR_MAX_DEPTH || !index_double (inode, h, nb))
+        goto done;
+      read_bucket (inode, sector = slot_get (inode, slot), b);
+    }
+
+  /* Names with the new bit set move to a new bucket at the end. */
+  bit = 1u << b->depth;
+  memset (nb, 0, sizeof *nb);
+  nb->depth = ++b->depth;
+  for (i = 0; i < b->cnt; )
+    if (hash_string (b->entries[i].name) & bit)
+      {
+        nb->entries[nb->cnt++] = b->entries[i];
+        b->entries[i] = b->entries[--b->cnt];
+      }
+    else
+      i++;
+
+  new_sector = inode_length (inode) / BLOCK_SECTOR_SIZE;
+  if (!write_bucket (inode, new_sector, nb))
+    goto done;
+  write_bucket (inode, sector, b);
+
+  /* The slots that end in the bucket's bits plus the new one. */
+  for (i = (slot & (bit - 1)) | bit; i < (1u << h->depth); i += bit << 1)
+    slot_put (inode, i, new_sector);
+  success = true;
+
+ done:
+  free (nb);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), DIR has been removed,
+   or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_header h;
+  struct dir_bucket *b;
+  block_sector_t bucket;
+  unsigned hash;
+  uint32_t slot;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
+    return false;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
     return false;
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  inode_lock_dir (dir->inode);
+  if (inode_is_removed (dir->inode) || find (dir, name) != DCACHE_ABSENT)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Find NAME's bucket, splitting it until it has room. */
+  hash = hash_string (name);
+  for (;;)
+    {
+      read_header (dir->inode, &h);
+      slot = hash & ((1u << h.depth) - 1);
+      bucket = slot_get (dir->inode, slot);
+      read_bucket (dir->inode, bucket, b);
+      if (b->cnt < BUCKET_ENTRIES)
+        break;
+      if (!bucket_split (dir->inode, &h, slot, bucket, b))
+        goto done;
+    }
 
   /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  b->entries[b->cnt].inode_sector = inode_sector;
+  strlcpy (b->entries[b->cnt].name, name, sizeof b->entries[b->cnt].name);
+  b->cnt++;
+  if (!write_bucket (dir->inode, bucket, b))
+    goto done;
+  h.entry_cnt++;
+  write_header (dir->inode, &h);
+  dcache_set (inode_get_inumber (dir->inode), name, inode_sector);
+  success = true;
 
  done:
+  inode_unlock_dir (dir->inode);
+  free (b);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs only if there is no file with the given NAME or it
+   is a directory that is not empty. */
 bool
-dir_remove (struct dir *dir, const char *name) 
+dir_remove (struct dir *dir, const char *name)
 {
+  struct dir_header h;
+  struct dir_bucket b;
   struct dir_entry e;
   struct inode *inode = NULL;
+  block_sector_t bucket;
+  uint32_t idx;
   bool success = false;
-  off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  inode_lock_dir (dir->inode);
+  if (!lookup (dir, name, &e, &bucket, &idx))
     goto done;
 
   /* Open inode. */
@@ -201,36 +479,94 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
-    goto done;
+  /* Only empty directories go.  Holding its lock until it is
+     marked removed keeps entries from being added meanwhile. */
+  if (inode_is_dir (inode))
+    {
+      inode_lock_dir (inode);
+      read_header (inode, &h);
+      if (h.entry_cnt > 0)
+        {
+          inode_unlock_dir (inode);
+          goto done;
+        }
+    }
 
-  /* Remove inode. */
-  inode_remove (inode);
-  success = true;
+  /* Erase directory entry: the bucket's last takes its place. */
+  read_bucket (dir->inode, bucket, &b);
+  b.entries[idx] = b.entries[--b.cnt];
+  if (write_bucket (dir->inode, bucket, &b))
+    {
+      read_header (dir->inode, &h);
+      h.entry_cnt--;
+      write_header (dir->inode, &h);
+      dcache_set (inode_get_inumber (dir->inode), name, DCACHE_ABSENT);
+
+      /* Remove inode. */
+      inode_remove (inode);
+      success = true;
+    }
+  if (inode_is_dir (inode))
+    inode_unlock_dir (inode);
 
  done:
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  "." and ".." are not listed. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dir_header h;
+  struct dir_bucket b;
+  block_sector_t sector;
+  uint32_t idx;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  /* POS counts entry places, BUCKET_ENTRIES per sector of the
+     file.  Buckets that grew past the index may be seen twice. */
+  inode_lock_dir (dir->inode);
+  read_header (dir->inode, &h);
+  for (;;)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      sector = dir->pos / BUCKET_ENTRIES;
+      idx = dir->pos % BUCKET_ENTRIES;
+      if (sector < (block_sector_t) index_sectors (h.depth))
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
+          dir->pos = index_sectors (h.depth) * BUCKET_ENTRIES;
+          continue;
+        }
+      if ((off_t) sector >= inode_length (dir->inode) / BLOCK_SECTOR_SIZE)
+        break;
+
+      read_bucket (dir->inode, sector, &b);
+      if (idx < b.cnt)
+        {
+          strlcpy (name, b.entries[idx].name, NAME_MAX + 1);
+          dir->pos++;
+          inode_unlock_dir (dir->inode);
           return true;
-        } 
+        }
+      dir->pos = (sector + 1) * BUCKET_ENTRIES;
     }
+  inode_unlock_dir (dir->inode);
   return false;
 }
+
+/* Sets DIR's position for dir_readdir() to POS, from an earlier
+   dir_tell(). */
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  dir->pos = pos;
+}
+
+/* Returns DIR's position for dir_readdir(). */
+off_t
+dir_tell (struct dir *dir)
+{
+  return dir->pos;
+}
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/block.h"
+#include "filesys/off_t.h"
 
 /* Maximum length of a file name component.
    This is the traditional UNIX maximum length.
@@ -11,10 +12,14 @@
    retained, but much longer full path names must be allowed. */
 #define NAME_MAX 14
 
+/* Most sectors dir_add() or dir_remove() logs, the directory's
+   inode and extent blocks included. */
+#define DIR_LOG_MAX 23
+
 struct inode;
 
 /* Opening and closing directories. */
-bool dir_create (block_sector_t sector, size_t entry_cnt);
+bool dir_create (block_sector_t sector, block_sector_t parent);
 struct dir *dir_open (struct inode *);
 struct dir *dir_open_root (void);
 struct dir *dir_reopen (struct dir *);
@@ -26,5 +31,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+void dir_seek (struct dir *, off_t);
+off_t dir_tell (struct dir *);
 
 #endif /* filesys/directory.h */
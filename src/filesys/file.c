@@ -15,6 +15,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ref_cnt = 1;
+      lock_init (&file->lock);
       return file;
     }
   else
@@ -33,12 +35,32 @@ file_reopen (struct file *file)
   return file_open (inode_reopen (file->inode));
 }
 
-/* Closes FILE. */
+/* Returns FILE with another reference to it, which the new
+   holder drops with file_close().  Holders share the position. */
+struct file *
+file_dup (struct file *file)
+{
+  lock_acquire (&file->lock);
+  file->ref_cnt++;
+  lock_release (&file->lock);
+  return file;
+}
+
+/* Drops a reference to FILE, and closes it if that was the
+   last. */
 void
 file_close (struct file *file) 
 {
+  bool last;
+
   if (file != NULL)
     {
+      lock_acquire (&file->lock);
+      last = --file->ref_cnt == 0;
+      lock_release (&file->lock);
+      if (!last)
+        return;
+
       file_allow_write (file);
       inode_close (file->inode);
       free (file); 
@@ -60,8 +82,12 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  lock_acquire (&file->lock);
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  lock_release (&file->lock);
   return bytes_read;
 }
 
@@ -86,8 +112,12 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written;
+
+  lock_acquire (&file->lock);
+  bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_written;
+  lock_release (&file->lock);
   return bytes_written;
 }
 
@@ -147,7 +177,9 @@ file_seek (struct file *file, off_t new_pos)
 {
   ASSERT (file != NULL);
   ASSERT (new_pos >= 0);
+  lock_acquire (&file->lock);
   file->pos = new_pos;
+  lock_release (&file->lock);
 }
 
 /* Returns the current position in FILE as a byte offset from the
@@ -155,6 +187,11 @@ file_seek (struct file *file, off_t new_pos)
 off_t
 file_tell (struct file *file) 
 {
+  off_t pos;
+
   ASSERT (file != NULL);
-  return file->pos;
+  lock_acquire (&file->lock);
+  pos = file->pos;
+  lock_release (&file->lock);
+  return pos;
 }
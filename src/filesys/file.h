@@ -2,13 +2,14 @@
 #define FILESYS_FILE_H
 
 #include "filesys/off_t.h"
-#include <list.h>
+#include "threads/synch.h"
 
 struct inode;
 
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
+struct file *file_dup (struct file *);
 void file_close (struct file *);
 struct inode *file_get_inode (struct file *);
 
@@ -33,10 +34,8 @@ struct file
   struct inode *inode;        /* File's inode. */
   off_t pos;                  /* Current position. */
   bool deny_write;            /* Has file_deny_write() been called? */
-  int fd;                     /* File descriptor */
-  bool mmaped;                /* Has the file been mmaped */
-  bool closed;                /* User has closed file */
-  struct list_elem elem;      /* For making a list of files in struct process */
+  int ref_cnt;                /* Holders, each to call file_close(). */
+  struct lock lock;           /* Guards POS and REF_CNT. */
 };
 
 #endif /* filesys/file.h */
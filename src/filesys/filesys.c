@@ -2,10 +2,14 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,13 +25,16 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
+  dcache_init ();
   inode_init ();
   free_map_init ();
-  
-  lock_init(&filesys_lock);
+  journal_init ();
 
   if (format) 
     do_format ();
+  else
+    journal_replay ();
 
   free_map_open ();
 }
@@ -38,37 +45,132 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_commit ();
+  cache_flush ();
 }
 
-/* Creates a file named NAME with the given INITIAL_SIZE.
-   Returns true if successful, false otherwise.
-   Fails if a file named NAME already exists,
-   or if internal memory allocation fails. */
-bool
-filesys_create (const char *name, off_t initial_size) 
+/* Opens the directory that holds the last component of PATH and
+   copies that component into NAME, or "." if PATH names a
+   directory only by slashes.  Relative paths start from the
+   current thread's directory.  Returns a null pointer if PATH is
+   empty, a component is too long, or a directory on the way does
+   not exist. */
+static struct dir *
+resolve (const char *path, char name[NAME_MAX + 1])
+{
+  struct thread *t = thread_current ();
+  struct inode *inode;
+  struct dir *dir;
+  size_t len;
+  bool have_name = false;
+
+  if (*path == '\0')
+    return NULL;
+  dir = *path == '/' || t->cwd == NULL ? dir_open_root () : dir_reopen (t->cwd);
+
+  for (;;)
+    {
+      while (*path == '/')
+        path++;
+      len = strcspn (path, "/");
+      if (len == 0 || dir == NULL)
+        break;
+      if (len > NAME_MAX)
+        {
+          dir_close (dir);
+          return NULL;
+        }
+
+      /* The component before this one is a directory on the way. */
+      if (have_name)
+        {
+          dir_lookup (dir, name, &inode);
+          dir_close (dir);
+          if (inode == NULL || !inode_is_dir (inode))
+            {
+              inode_close (inode);
+              return NULL;
+            }
+          dir = dir_open (inode);
+        }
+      memcpy (name, path, len);
+      name[len] = '\0';
+      have_name = true;
+      path += len;
+    }
+
+  if (!have_name)
+    strlcpy (name, ".", NAME_MAX + 1);
+  return dir;
+}
+
+/* Creates a file or, if IS_DIR, a directory at PATH, of
+   INITIAL_SIZE bytes if a file.  All of it is committed to the
+   journal together. */
+static bool
+create (const char *path, off_t initial_size, bool is_dir)
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+  bool created = false;
+  bool success;
+
+  /* Adding the name, and the new inode with a new directory's first
+     sector. */
+  journal_begin (DIR_LOG_MAX + 2);
+  dir = resolve (path, name);
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && (created = is_dir
+                 ? dir_create (inode_sector,
+                               inode_get_inumber (dir_get_inode (dir)))
+                 : inode_create (inode_sector, initial_size, false))
+             && dir_add (dir, name, inode_sector));
+  if (!success && created)
+    {
+      /* Removing the inode frees its sector with its data. */
+      struct inode *inode = inode_open (inode_sector);
+      if (inode != NULL)
+        inode_remove (inode);
+      inode_close (inode);
+    }
+  else if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Creates a file at PATH with the given INITIAL_SIZE.
+   Returns true if successful, false otherwise.
+   Fails if a file at PATH already exists, its directory does not,
+   or if internal memory allocation fails. */
+bool
+filesys_create (const char *path, off_t initial_size) 
+{
+  return create (path, initial_size, false);
+}
+
+/* Creates an empty directory at PATH.  Returns true if
+   successful, false otherwise, as filesys_create(). */
+bool
+filesys_mkdir (const char *path)
+{
+  return create (path, 0, true);
+}
+
+/* Opens the file or directory at PATH.
    Returns the new file if successful or a null pointer
    otherwise.
-   Fails if no file named NAME exists,
+   Fails if nothing exists at PATH,
    or if an internal memory allocation fails. */
 struct file *
-filesys_open (const char *name)
+filesys_open (const char *path)
 {
-  struct dir *dir = dir_open_root ();
+  char name[NAME_MAX + 1];
+  struct dir *dir = resolve (path, name);
   struct inode *inode = NULL;
 
   if (dir != NULL)
@@ -78,28 +180,69 @@ filesys_open (const char *name)
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory at PATH.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if nothing exists at PATH, it is a directory with
+   entries, or if an internal memory allocation fails. */
 bool
-filesys_remove (const char *name) 
+filesys_remove (const char *path) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  /* The removed inode's sectors are released without logging. */
+  journal_begin (DIR_LOG_MAX);
+  dir = resolve (path, name);
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
-
+
+/* Makes the directory at PATH the current thread's directory.
+   Returns true if successful, false if there is no directory
+   there. */
+bool
+filesys_chdir (const char *path)
+{
+  struct thread *t = thread_current ();
+  char name[NAME_MAX + 1];
+  struct dir *dir = resolve (path, name);
+  struct inode *inode = NULL;
+
+  if (dir != NULL)
+    dir_lookup (dir, name, &inode);
+  dir_close (dir);
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  journal_format ();
+
+  /* The free map's inode and data, and the root's inode and first
+     sector. */
+  journal_begin (free_map_sectors () + 3);
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  journal_end ();
   free_map_close ();
   printf ("done.\n");
 }
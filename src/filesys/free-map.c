@@ -1,52 +1,340 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Sectors described by each sector of the free map file. */
+#define SECTOR_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/* Sectors per group.  A count of free sectors is kept for each
+   group, so that searches can skip full ones. */
+#define GROUP_SIZE 512
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Changes to the free map reach the file only from
+   free_map_flush(): one bit per sector of the file, set for those
+   that differ from the file. */
+static struct bitmap *dirty;
+
+/* Sectors released since the last free_map_flush(), and those
+   released before it, which the file shows free but which stay in
+   use until the journal has committed the flush.  Otherwise a
+   sector could be reused, and written unlogged, before the change
+   that released it is durable. */
+static struct bitmap *pending;
+static struct bitmap *flushed;
+
+/* Free sectors in each group. */
+static size_t *group_free;
+static size_t group_cnt;
+
+/* Guards all of the above. */
+static struct lock free_map_lock;
+
+static void mark (size_t start, size_t cnt, bool used);
+static void set_sectors (size_t start, size_t cnt, bool used);
+static void mark_dirty (size_t start, size_t cnt);
+static bool write_sector (size_t idx);
+static void count_groups (void);
+static bool next_run (size_t pos, size_t *start, size_t *end);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
+  size_t sectors = block_size (fs_device);
+
+  free_map = bitmap_create (sectors);
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty = bitmap_create (DIV_ROUND_UP (sectors, SECTOR_BITS));
+  pending = bitmap_create (sectors);
+  flushed = bitmap_create (sectors);
+  group_cnt = DIV_ROUND_UP (sectors, GROUP_SIZE);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (dirty == NULL || pending == NULL || flushed == NULL
+      || group_free == NULL)
+    PANIC ("free map summary allocation failed");
+  lock_init (&free_map_lock);
+
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  count_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t start, end;
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  for (end = 0; next_run (end, &start, &end); )
+    if (end - start >= cnt)
+      {
+        mark (start, cnt, true);
+        *sectorp = start;
+        success = true;
+        break;
+      }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates a run of sectors for CNT sectors' worth of data and
+   stores the first into *SECTORP: the smallest free run of at
+   least CNT sectors, of which CNT are taken, or failing that the
+   largest free run, all of it.  Returns the number of sectors
+   allocated, 0 if the disk is full. */
+size_t
+free_map_allocate_best (size_t cnt, block_sector_t *sectorp)
+{
+  size_t best = BITMAP_ERROR, best_cnt = 0;
+  size_t start, end;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  for (end = 0; next_run (end, &start, &end); )
+    {
+      /* A fitting run beats any that doesn't fit, and the smaller
+         fitting run the better; otherwise the larger the better. */
+      if (best == BITMAP_ERROR
+          || (end - start >= cnt
+              ? best_cnt < cnt || end - start < best_cnt
+              : best_cnt < cnt && end - start > best_cnt))
+        {
+          best = start;
+          best_cnt = end - start;
+          if (best_cnt == cnt)
+            break;
+        }
+    }
+
+  if (best != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      if (best_cnt > cnt)
+        best_cnt = cnt;
+      mark (best, best_cnt, true);
+      *sectorp = best;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  return best_cnt;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates the free sectors from SECTOR on, up to CNT of them,
+   for a file to grow in place.  Returns how many were allocated,
+   which is 0 if SECTOR is in use. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  size_t got = 0;
+
+  lock_acquire (&free_map_lock);
+  while (got < cnt && sector + got < bitmap_size (free_map)
+         && !bitmap_test (free_map, sector + got))
+    got++;
+  if (got > 0)
+    mark (sector, got, true);
+  lock_release (&free_map_lock);
+  return got;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, once
+   the journal has committed the release. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  ASSERT (bitmap_none (pending, sector, cnt));
+  ASSERT (bitmap_none (flushed, sector, cnt));
+  bitmap_set_multiple (pending, sector, cnt, true);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released before the last free_map_flush()
+   available for use.  Called by the journal once it has committed
+   that flush. */
+void
+free_map_commit (void)
+{
+  size_t start, end;
+
+  lock_acquire (&free_map_lock);
+  for (start = 0; start < bitmap_size (flushed); start = end)
+    {
+      start = bitmap_scan (flushed, start, 1, true);
+      if (start == BITMAP_ERROR)
+        break;
+      for (end = start + 1; end < bitmap_size (flushed)
+                            && bitmap_test (flushed, end); end++)
+        continue;
+      /* The file shows them free already. */
+      bitmap_set_multiple (flushed, start, end - start, false);
+      set_sectors (start, end - start, false);
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Returns the number of sectors of free map file data, which is
+   the most a flush of it logs. */
+size_t
+free_map_sectors (void)
+{
+  return bitmap_size (dirty);
+}
+
+/* Writes the sectors of the free map file that are out of date.
+   Their sectors go to the buffer cache, logged for the journal
+   like any metadata.  The caller must be in a journal operation,
+   as the free map is locked meanwhile. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    {
+      for (i = 0; i < bitmap_size (pending); i++)
+        if (bitmap_test (pending, i))
+          {
+            bitmap_reset (pending, i);
+            bitmap_mark (flushed, i);
+          }
+      for (i = 0; i < bitmap_size (dirty); i++)
+        if (bitmap_test (dirty, i))
+          {
+            if (!write_sector (i))
+              PANIC ("can't write free map");
+            bitmap_reset (dirty, i);
+          }
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Writes sector IDX of the free map file, showing the sectors
+   released by the flush as free.  Returns true if successful.  The
+   caller must hold free_map_lock. */
+static bool
+write_sector (size_t idx)
+{
+  size_t start = idx * SECTOR_BITS;
+  size_t cnt = bitmap_size (free_map) - start;
+  size_t i;
+  bool success;
+
+  if (cnt > SECTOR_BITS)
+    cnt = SECTOR_BITS;
+  for (i = start; i < start + cnt; i++)
+    if (bitmap_test (flushed, i))
+      bitmap_reset (free_map, i);
+  success = bitmap_write_range (free_map, free_map_file, start, cnt);
+  for (i = start; i < start + cnt; i++)
+    if (bitmap_test (flushed, i))
+      bitmap_mark (free_map, i);
+  return success;
+}
+
+/* Marks CNT sectors from START as USED or not, keeping the group
+   counts and dirty sectors up to date.  The caller must hold
+   free_map_lock. */
+static void
+mark (size_t start, size_t cnt, bool used)
+{
+  set_sectors (start, cnt, used);
+  mark_dirty (start, cnt);
+}
+
+/* Marks CNT sectors from START as USED or not, keeping the group
+   counts up to date.  The caller must hold free_map_lock. */
+static void
+set_sectors (size_t start, size_t cnt, bool used)
+{
+  size_t end = start + cnt;
+  size_t pos, next;
+
+  bitmap_set_multiple (free_map, start, cnt, used);
+  for (pos = start; pos < end; pos = next)
+    {
+      size_t g = pos / GROUP_SIZE;
+
+      next = (g + 1) * GROUP_SIZE < end ? (g + 1) * GROUP_SIZE : end;
+      if (used)
+        group_free[g] -= next - pos;
+      else
+        group_free[g] += next - pos;
+    }
+}
+
+/* Marks the sectors of the free map file that describe CNT sectors
+   from START as out of date.  The caller must hold free_map_lock. */
+static void
+mark_dirty (size_t start, size_t cnt)
+{
+  if (cnt > 0)
+    bitmap_set_multiple (dirty, start / SECTOR_BITS,
+                         (start + cnt - 1) / SECTOR_BITS
+                         - start / SECTOR_BITS + 1,
+                         true);
+}
+
+/* Counts the free sectors in each group from scratch. */
+static void
+count_groups (void)
+{
+  size_t sectors = bitmap_size (free_map);
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    {
+      size_t start = g * GROUP_SIZE;
+      size_t cnt = sectors - start < GROUP_SIZE ? sectors - start : GROUP_SIZE;
+
+      group_free[g] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Finds the first run of free sectors at or after POS and stores
+   its bounds into *START and *END.  Returns false if there is
+   none.  Full groups, and free ones, are passed over whole.  The
+   caller must hold free_map_lock. */
+static bool
+next_run (size_t pos, size_t *start, size_t *end)
+{
+  size_t sectors = bitmap_size (free_map);
+
+  for (; pos < sectors; pos++)
+    if (pos % GROUP_SIZE == 0 && group_free[pos / GROUP_SIZE] == 0)
+      pos += GROUP_SIZE - 1;
+    else if (!bitmap_test (free_map, pos))
+      break;
+  if (pos >= sectors)
+    return false;
+  *start = pos;
+
+  for (pos++; pos < sectors; pos++)
+    if (pos % GROUP_SIZE == 0 && group_free[pos / GROUP_SIZE] == GROUP_SIZE)
+      pos += GROUP_SIZE - 1;
+    else if (bitmap_test (free_map, pos))
+      break;
+  *end = pos < sectors ? pos : sectors;
+  return true;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +346,24 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  /* A commit flushes the free map with its batch.  Later commits
+     have nothing to flush. */
+  journal_commit ();
+
+  lock_acquire (&free_map_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,13 +372,17 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  The file starts out as a hole, so the
+     write allocates its sectors, and marks whatever it changes to
+     be flushed again.  Once it is done the file has no holes left,
+     so free_map_flush() never needs to allocate. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  bitmap_set_all (dirty, false);
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
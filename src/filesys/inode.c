@@ -1,23 +1,78 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Sector 0 holds the free map, so it doubles as "none", and as
+   the start of a hole. */
+#define NO_SECTOR 0
+
+/* Most sectors preallocated past the end of a growing file. */
+#define PREALLOC_MAX 64
+
+/* Contents of a new sector. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* A run of consecutive data sectors, or a hole: a run of data
+   sectors not allocated yet, which read as zeros. */
+struct extent
+  {
+    block_sector_t start;               /* First sector, or NO_SECTOR. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Extents kept in the inode itself and in each extent block. */
+#define INODE_EXTENT_CNT 60
+#define EXTENT_BLOCK_CNT 63
+
+/* Most extent blocks a file may have, so that the sectors an
+   operation logs for it stay within INODE_LOG_MAX. */
+#define EXTENT_BLOCK_MAX (INODE_LOG_MAX - 1)
+
+/* Most bytes of data kept in the inode itself, in place of its
+   extents. */
+#define INODE_INLINE_MAX (INODE_EXTENT_CNT * sizeof (struct extent))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A file with no data sectors, one never longer than
+   INODE_INLINE_MAX bytes, keeps its data in CONTENTS, with zeros
+   past its end.  It moves to data sectors when it grows past
+   that, and stays there. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        struct extent extents[INODE_EXTENT_CNT]; /* First data runs. */
+        uint8_t contents[INODE_INLINE_MAX]; /* Data of a small file. */
+      };
+    block_sector_t extent_block;        /* First extent block, if any. */
+    uint32_t extent_cnt;                /* Extents in all. */
+    uint32_t sector_cnt;                /* Data sectors in all extents. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
+    uint32_t unused[2];                 /* Not used. */
+  };
+
+/* Further extents of a file with many, in a chain of sectors. */
+struct extent_block
+  {
+    struct extent extents[EXTENT_BLOCK_CNT]; /* Data runs, in order. */
+    block_sector_t next;                /* Next extent block, if any. */
+    uint32_t unused;                    /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,16 +86,48 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
+    struct list_elem closing_elem;      /* Element in closing_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    struct lock lock;                   /* Guards the members below. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    struct lock dir_lock;               /* See inode_lock_dir(). */
   };
 
+static block_sector_t data_sector (const struct inode_disk *, size_t idx);
+static uint32_t extent_find (const struct inode_disk *, size_t idx,
+                             struct extent *, size_t *ofs);
+static block_sector_t extent_block (const struct inode_disk *, uint32_t blk);
+static void extent_get (const struct inode_disk *, uint32_t, struct extent *);
+static void extent_put (struct inode_disk *, uint32_t, const struct extent *);
+static bool extent_append (struct inode_disk *, const struct extent *);
+static bool extent_insert (struct inode_disk *, uint32_t,
+                           const struct extent *);
+static void extent_remove (struct inode_disk *, uint32_t);
+static void extent_pop (struct inode_disk *);
+static bool inode_allocate (struct inode_disk *, size_t cnt);
+static bool inode_hole (struct inode_disk *, size_t cnt);
+static block_sector_t inode_fill (struct inode *, size_t idx);
+static bool inode_spill (struct inode_disk *);
+static bool inode_extend (struct inode_disk *, off_t length, size_t first,
+                          size_t extra);
+static void inode_trim (struct inode_disk *, size_t cnt);
+static void inode_release (const struct inode_disk *);
+static bool write_logs (const struct inode *, off_t offset, off_t size);
+
+/* Returns true if DISK keeps its data in the inode. */
+static inline bool
+is_inline (const struct inode_disk *disk)
+{
+  return disk->sector_cnt == 0;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, which must not keep its data inline, or NO_SECTOR
+   if POS is in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
@@ -48,29 +135,546 @@ byte_to_sector (const struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return data_sector (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Returns the sector holding data sector IDX of the file DISK
+   describes, which must be mapped, or NO_SECTOR if it is in a
+   hole. */
+static block_sector_t
+data_sector (const struct inode_disk *disk, size_t idx)
+{
+  struct extent e;
+  size_t ofs;
+
+  extent_find (disk, idx, &e, &ofs);
+  return e.start != NO_SECTOR ? e.start + ofs : NO_SECTOR;
+}
+
+/* Finds the extent of DISK that maps data sector IDX, which must
+   be mapped.  Returns its number and stores it in *E, and IDX's
+   position within it in *OFS. */
+static uint32_t
+extent_find (const struct inode_disk *disk, size_t idx, struct extent *e,
+             size_t *ofs)
+{
+  struct extent_block block;
+  block_sector_t sector;
+  uint32_t i, j;
+
+  ASSERT (idx < disk->sector_cnt);
+
+  for (i = 0; i < disk->extent_cnt && i < INODE_EXTENT_CNT; i++)
+    {
+      if (idx < disk->extents[i].length)
+        {
+          *e = disk->extents[i];
+          *ofs = idx;
+          return i;
+        }
+      idx -= disk->extents[i].length;
+    }
+
+  for (sector = disk->extent_block; i < disk->extent_cnt;
+       sector = block.next)
+    {
+      cache_read_at (sector, &block, 0, BLOCK_SECTOR_SIZE);
+      for (j = 0; j < EXTENT_BLOCK_CNT && i < disk->extent_cnt; j++, i++)
+        {
+          if (idx < block.extents[j].length)
+            {
+              *e = block.extents[j];
+              *ofs = idx;
+              return i;
+            }
+          idx -= block.extents[j].length;
+        }
+    }
+  NOT_REACHED ();
+}
+
+/* Returns the sector of extent block BLK, counting from 0, of
+   DISK. */
+static block_sector_t
+extent_block (const struct inode_disk *disk, uint32_t blk)
+{
+  block_sector_t sector = disk->extent_block;
+
+  while (blk-- > 0)
+    cache_read_at (sector, &sector, offsetof (struct extent_block, next),
+                   sizeof sector);
+  return sector;
+}
+
+/* Reads extent I of DISK into *E. */
+static void
+extent_get (const struct inode_disk *disk, uint32_t i, struct extent *e)
+{
+  ASSERT (i < disk->extent_cnt);
+
+  if (i < INODE_EXTENT_CNT)
+    *e = disk->extents[i];
+  else
+    {
+      i -= INODE_EXTENT_CNT;
+      cache_read_at (extent_block (disk, i / EXTENT_BLOCK_CNT), e,
+                     i % EXTENT_BLOCK_CNT * sizeof *e, sizeof *e);
+    }
+}
+
+/* Sets extent I of DISK to *E. */
+static void
+extent_put (struct inode_disk *disk, uint32_t i, const struct extent *e)
+{
+  ASSERT (i < disk->extent_cnt);
+
+  if (i < INODE_EXTENT_CNT)
+    disk->extents[i] = *e;
+  else
+    {
+      i -= INODE_EXTENT_CNT;
+      cache_log_at (extent_block (disk, i / EXTENT_BLOCK_CNT), e,
+                    i % EXTENT_BLOCK_CNT * sizeof *e, sizeof *e);
+    }
+}
+
+/* Adds *E after the last extent of DISK, starting a new extent
+   block if the last one is full.  Returns false if that needs a
+   sector and the disk is full, or DISK has EXTENT_BLOCK_MAX
+   extent blocks already. */
+static bool
+extent_append (struct inode_disk *disk, const struct extent *e)
+{
+  uint32_t i = disk->extent_cnt;
+  block_sector_t sector;
+
+  if (i >= INODE_EXTENT_CNT && (i - INODE_EXTENT_CNT) % EXTENT_BLOCK_CNT == 0)
+    {
+      /* An all-zero block is empty and ends the chain. */
+      if ((i - INODE_EXTENT_CNT) / EXTENT_BLOCK_CNT >= EXTENT_BLOCK_MAX
+          || !free_map_allocate (1, &sector))
+        return false;
+      cache_log_at (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+      if (i == INODE_EXTENT_CNT)
+        disk->extent_block = sector;
+      else
+        cache_log_at (extent_block (disk, (i - INODE_EXTENT_CNT)
+                                          / EXTENT_BLOCK_CNT - 1),
+                      &sector, offsetof (struct extent_block, next),
+                      sizeof sector);
+    }
+  disk->extent_cnt++;
+  extent_put (disk, i, e);
+  return true;
+}
+
+/* Inserts *E before extent I of DISK, moving the later ones up.
+   Returns false, changing nothing, if that needs a sector and
+   the disk is full. */
+static bool
+extent_insert (struct inode_disk *disk, uint32_t i, const struct extent *e)
+{
+  struct extent moved;
+  uint32_t j;
+
+  ASSERT (i <= disk->extent_cnt);
+
+  if (i == disk->extent_cnt)
+    return extent_append (disk, e);
+
+  extent_get (disk, disk->extent_cnt - 1, &moved);
+  if (!extent_append (disk, &moved))
+    return false;
+  for (j = disk->extent_cnt - 2; j > i; j--)
+    {
+      extent_get (disk, j - 1, &moved);
+      extent_put (disk, j, &moved);
+    }
+  extent_put (disk, i, e);
+  return true;
+}
+
+/* Removes extent I of DISK, moving the later ones down.  The
+   sectors it maps are the caller's to deal with. */
+static void
+extent_remove (struct inode_disk *disk, uint32_t i)
+{
+  struct extent moved;
+
+  ASSERT (i < disk->extent_cnt);
+
+  for (; i + 1 < disk->extent_cnt; i++)
+    {
+      extent_get (disk, i + 1, &moved);
+      extent_put (disk, i, &moved);
+    }
+  extent_pop (disk);
+}
+
+/* Drops the last extent of DISK, and the extent block that held
+   it if it was the first there. */
+static void
+extent_pop (struct inode_disk *disk)
+{
+  uint32_t i = disk->extent_cnt - 1;
+
+  ASSERT (disk->extent_cnt > 0);
+
+  if (i >= INODE_EXTENT_CNT && (i - INODE_EXTENT_CNT) % EXTENT_BLOCK_CNT == 0)
+    {
+      uint32_t blk = (i - INODE_EXTENT_CNT) / EXTENT_BLOCK_CNT;
+      block_sector_t none = NO_SECTOR;
+
+      free_map_release (extent_block (disk, blk), 1);
+      if (blk == 0)
+        disk->extent_block = NO_SECTOR;
+      else
+        cache_log_at (extent_block (disk, blk - 1), &none,
+                      offsetof (struct extent_block, next), sizeof none);
+    }
+  disk->extent_cnt--;
+}
+
+/* Allocates data sectors for DISK until it has CNT, in as few
+   runs as the free map allows: the last run grows in place if
+   the sectors after it are free, and a new one is the best fit
+   for what is still needed, or the longest free run there is.
+   Returns false if the disk fills up first, in which case DISK
+   keeps the sectors it got.  DISK is the caller's to write
+   back. */
+static bool
+inode_allocate (struct inode_disk *disk, size_t cnt)
+{
+  struct extent e;
+  size_t got;
+
+  while (disk->sector_cnt < cnt)
+    {
+      if (disk->extent_cnt > 0)
+        {
+          extent_get (disk, disk->extent_cnt - 1, &e);
+          got = (e.start == NO_SECTOR ? 0 :
+                 free_map_allocate_at (e.start + e.length,
+                                      cnt - disk->sector_cnt));
+          if (got > 0)
+            {
+              e.length += got;
+              extent_put (disk, disk->extent_cnt - 1, &e);
+              disk->sector_cnt += got;
+              continue;
+            }
+        }
+
+      e.length = free_map_allocate_best (cnt - disk->sector_cnt, &e.start);
+      if (e.length == 0)
+        return false;
+      if (!extent_append (disk, &e))
+        {
+          free_map_release (e.start, e.length);
+          return false;
+        }
+      disk->sector_cnt += e.length;
+    }
+  return true;
+}
+
+/* Maps CNT more data sectors of DISK as a hole.  Returns false if
+   that needs a sector and the disk is full.  DISK is the caller's
+   to write back. */
+static bool
+inode_hole (struct inode_disk *disk, size_t cnt)
+{
+  struct extent e;
+
+  if (disk->extent_cnt > 0)
+    {
+      extent_get (disk, disk->extent_cnt - 1, &e);
+      if (e.start == NO_SECTOR)
+        {
+          e.length += cnt;
+          extent_put (disk, disk->extent_cnt - 1, &e);
+          disk->sector_cnt += cnt;
+          return true;
+        }
+    }
+
+  e.start = NO_SECTOR;
+  e.length = cnt;
+  if (!extent_append (disk, &e))
+    return false;
+  disk->sector_cnt += cnt;
+  return true;
+}
+
+/* Gives data sector IDX of INODE, which is in a hole, a zeroed
+   sector of its own, and returns it.  The sector continues the
+   run before the hole if the free map allows, so that filling a
+   hole from its start makes one run.  Otherwise the hole is split
+   around it.  Returns NO_SECTOR if the disk is full.  The caller
+   must hold INODE's lock. */
+static block_sector_t
+inode_fill (struct inode *inode, size_t idx)
+{
+  struct inode_disk *disk = &inode->data;
+  struct extent hole, prev, before, after;
+  block_sector_t sector;
+  size_t ofs;
+  uint32_t i;
+
+  i = extent_find (disk, idx, &hole, &ofs);
+  ASSERT (hole.start == NO_SECTOR);
+
+  if (ofs == 0 && i > 0)
+    {
+      extent_get (disk, i - 1, &prev);
+      if (prev.start != NO_SECTOR
+          && free_map_allocate_at (prev.start + prev.length, 1) == 1)
+        {
+          sector = prev.start + prev.length++;
+          extent_put (disk, i - 1, &prev);
+          if (--hole.length > 0)
+            extent_put (disk, i, &hole);
+          else
+            extent_remove (disk, i);
+          goto done;
+        }
+    }
+
+  /* Split the hole into what is BEFORE the new sector, the new
+     sector and what is AFTER it.  Only inserting can fail, so that
+     is done first. */
+  if (!free_map_allocate (1, &sector))
+    return NO_SECTOR;
+  before.start = after.start = NO_SECTOR;
+  before.length = ofs;
+  after.length = hole.length - ofs - 1;
+  hole.start = sector;
+  hole.length = 1;
+  if (after.length > 0 && !extent_insert (disk, i + 1, &after))
+    goto fail;
+  if (before.length > 0)
+    {
+      if (!extent_insert (disk, i + 1, &hole))
+        {
+          if (after.length > 0)
+            extent_remove (disk, i + 1);
+          goto fail;
+        }
+      extent_put (disk, i, &before);
+    }
+  else
+    extent_put (disk, i, &hole);
+
+ done:
+  cache_write_at (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+  cache_log_at (inode->sector, disk, 0, BLOCK_SECTOR_SIZE);
+  return sector;
+
+ fail:
+  free_map_release (sector, 1);
+  return NO_SECTOR;
+}
+
+/* Moves the data of DISK, which is kept inline, to a data
+   sector of its own.  Returns false if the disk is full, in which
+   case DISK is unchanged.  DISK is the caller's to write back. */
+static bool
+inode_spill (struct inode_disk *disk)
+{
+  block_sector_t sector;
+
+  ASSERT (is_inline (disk));
+
+  if (!free_map_allocate (1, &sector))
+    return false;
+  cache_write_at (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+  cache_write_at (sector, disk->contents, 0, disk->length);
+
+  memset (disk->contents, 0, sizeof disk->contents);
+  disk->extents[0].start = sector;
+  disk->extents[0].length = 1;
+  disk->extent_cnt = 1;
+  disk->sector_cnt = 1;
+  return true;
+}
+
+/* Zeroes data sector IDX of DISK, unless it is in a hole. */
+static void
+zero_sector (const struct inode_disk *disk, size_t idx)
+{
+  block_sector_t sector = data_sector (disk, idx);
+
+  if (sector != NO_SECTOR)
+    cache_write_at (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Makes DISK LENGTH bytes long, if it is not already, with zeros
+   past its old end.  A file that fits stays inline.  Otherwise
+   data sectors before sector FIRST that are not mapped yet become
+   a hole, and the rest are allocated, with up to EXTRA more beyond
+   LENGTH so that later growth stays in the same runs.  Returns
+   false if the disk is full, in which case DISK maps what it did
+   before, though inline data may have moved to a data sector.
+   DISK is the caller's to write back. */
+static bool
+inode_extend (struct inode_disk *disk, off_t length, size_t first,
+              size_t extra)
+{
+  size_t cnt = bytes_to_sectors (length);
+  size_t mapped = disk->sector_cnt;
+  size_t idx, end;
+
+  if (length <= disk->length)
+    return true;
+  if (is_inline (disk))
+    {
+      if ((size_t) length <= INODE_INLINE_MAX)
+        {
+          memset (disk->contents + disk->length, 0, length - disk->length);
+          disk->length = length;
+          return true;
+        }
+      if (disk->length > 0 && !inode_spill (disk))
+        return false;
+      mapped = disk->sector_cnt;
+    }
+  if (first > cnt)
+    first = cnt;
+  if (first > mapped && !inode_hole (disk, first - mapped))
+    return false;
+  if (!inode_allocate (disk, cnt))
+    {
+      inode_trim (disk, mapped);
+      return false;
+    }
+  if (extra > 0)
+    inode_allocate (disk, cnt + extra);
+
+  /* Sectors are only zeroed as the file grows into them: those
+     preallocated before, then the new ones after any hole.  The
+     rest of the last sector is zero already, and a hole reads as
+     zeros without being written. */
+  end = mapped < cnt ? mapped : cnt;
+  for (idx = bytes_to_sectors (disk->length); idx < end; idx++)
+    zero_sector (disk, idx);
+  for (idx = first > mapped ? first : mapped; idx < cnt; idx++)
+    zero_sector (disk, idx);
+  disk->length = length;
+  return true;
+}
+
+/* Releases DISK's data sectors past the first CNT, and any extent
+   blocks no longer needed.  DISK is the caller's to write back. */
+static void
+inode_trim (struct inode_disk *disk, size_t cnt)
+{
+  struct extent e;
+  uint32_t i;
+  size_t drop;
+
+  while (disk->sector_cnt > cnt)
+    {
+      i = disk->extent_cnt - 1;
+      extent_get (disk, i, &e);
+      drop = disk->sector_cnt - cnt;
+      if (drop > e.length)
+        drop = e.length;
+      if (e.start != NO_SECTOR)
+        free_map_release (e.start + e.length - drop, drop);
+      e.length -= drop;
+      disk->sector_cnt -= drop;
+      if (e.length > 0)
+        extent_put (disk, i, &e);
+      else
+        extent_pop (disk);
+    }
+}
+
+/* Releases all of DISK's sectors, data and extent blocks alike.
+   Nothing reads DISK again, so none of it is written, and nothing
+   is logged. */
+static void
+inode_release (const struct inode_disk *disk)
+{
+  struct extent e;
+  uint32_t i, blk;
+
+  for (i = 0; i < disk->extent_cnt; i++)
+    {
+      extent_get (disk, i, &e);
+      if (e.start != NO_SECTOR)
+        free_map_release (e.start, e.length);
+    }
+
+  /* The last block first, since finding one reads those before. */
+  if (disk->extent_cnt > INODE_EXTENT_CNT)
+    for (blk = DIV_ROUND_UP (disk->extent_cnt - INODE_EXTENT_CNT,
+                             EXTENT_BLOCK_CNT); blk-- > 0; )
+      free_map_release (extent_block (disk, blk), 1);
+}
+
+/* Open inodes by sector, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+
+/* Inodes whose last opener is trimming or releasing them.  Their
+   sectors cannot be opened again until that is done. */
+static struct list closing_inodes;
+static struct condition inode_closed;
+
+/* Guards open_inodes, closing_inodes and the OPEN_CNT of every inode
+   in them. */
+static struct lock open_inodes_lock;
+
+/* Returns true if the inode at SECTOR is being closed. */
+static bool
+inode_is_closing (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&closing_inodes); e != list_end (&closing_inodes);
+       e = list_next (e))
+    if (list_entry (e, struct inode, closing_elem)->sector == sector)
+      return true;
+  return false;
+}
+
+/* Hashes an inode by its sector. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Orders inodes by sector. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closing_inodes);
+  cond_init (&inode_closed);
+  lock_init (&open_inodes_lock);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
+/* Initializes an inode with LENGTH bytes of data, all zeros,
+   and writes the new inode to sector SECTOR on the file system
+   device.  The data is a hole, so no data sectors are written
+   until it is.  IS_DIR says whether it holds a directory.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -84,22 +688,15 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->is_dir = is_dir;
+      if (inode_extend (disk_inode, length, bytes_to_sectors (length), 0)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          cache_log_at (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
           success = true; 
         } 
+      else
+        inode_trim (disk_inode, 0);
       free (disk_inode);
     }
   return success;
@@ -111,33 +708,48 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open.  Its opener holds
+     its lock until it has been read in. */
+  lock_acquire (&open_inodes_lock);
+  while (inode_is_closing (sector))
+    cond_wait (&inode_closed, &open_inodes_lock);
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      lock_acquire (&inode->lock);
+      lock_release (&inode->lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
-  inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  inode->deny_write_cnt = 0;
+  lock_init (&inode->dir_lock);
+  lock_acquire (&inode->lock);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  cache_read_at (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_release (&inode->lock);
   return inode;
 }
 
@@ -146,7 +758,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -158,7 +774,8 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
+   If this was the last reference to INODE, frees its memory and
+   any sectors preallocated past its end.
    If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) 
@@ -167,22 +784,43 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener.  That is done
+     outside open_inodes_lock, since it reads through the cache, but
+     before anyone can open the inode again. */
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
-        }
+      lock_release (&open_inodes_lock);
+      return;
+    }
 
-      free (inode); 
+  /* Move from inode table to the closing list. */
+  hash_delete (&open_inodes, &inode->elem);
+  list_push_back (&closing_inodes, &inode->closing_elem);
+  lock_release (&open_inodes_lock);
+
+  /* Deallocate blocks if removed, or give back the spare sectors
+     of a file that grew.  Only that needs a journal operation. */
+  if (inode->removed) 
+    {
+      journal_begin (INODE_LOG_MAX);
+      free_map_release (inode->sector, 1);
+      inode_release (&inode->data);
+      journal_end ();
     }
+  else if (inode->data.sector_cnt > bytes_to_sectors (inode->data.length))
+    {
+      journal_begin (INODE_LOG_MAX);
+      inode_trim (&inode->data, bytes_to_sectors (inode->data.length));
+      cache_log_at (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+      journal_end ();
+    }
+
+  lock_acquire (&open_inodes_lock);
+  list_remove (&inode->closing_elem);
+  cond_broadcast (&inode_closed, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
+  free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -194,126 +832,271 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns true if INODE holds a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Acquires INODE's directory lock.  The inode functions never
+   take it; the directory code holds it across reading and
+   changing a directory's entries. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   The sector after the last one read is read ahead.
+   INODE's lock is only held to find each sector, so reads and
+   writes of one file run side by side, except that writes that
+   extend the file keep it until they are done. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t next;
+
+  /* A small file is all there in the inode. */
+  lock_acquire (&inode->lock);
+  if (is_inline (&inode->data))
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inode->data.contents + offset, bytes_read);
+        }
+      lock_release (&inode->lock);
+      return bytes_read;
+    }
+  lock_release (&inode->lock);
 
+  /* Otherwise it stays in data sectors while it is open. */
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int min_left;
 
       /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
+      int chunk_size;
+
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      inode_left = inode->data.length - offset;
+      lock_release (&inode->lock);
+
+      min_left = inode_left < sector_left ? inode_left : sector_left;
+      chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != NO_SECTOR)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  next = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  if (bytes_read > 0)
+    {
+      block_sector_t sector = NO_SECTOR;
+
+      lock_acquire (&inode->lock);
+      if (next < inode->data.length)
+        sector = byte_to_sector (inode, next);
+      lock_release (&inode->lock);
+      if (sector != NO_SECTOR)
+        cache_read_ahead (sector);
+    }
 
   return bytes_read;
 }
 
+/* Returns true if writing SIZE bytes into INODE at OFFSET logs
+   metadata: if it extends INODE, fills a hole, or writes inline
+   data, a directory or the free map.  The caller must hold INODE's
+   lock. */
+static bool
+write_logs (const struct inode *inode, off_t offset, off_t size)
+{
+  size_t idx, end, ofs;
+  struct extent e;
+
+  if (offset + size > inode->data.length
+      || is_inline (&inode->data)
+      || inode->data.is_dir || inode->sector == FREE_MAP_SECTOR)
+    return true;
+
+  /* Look for a hole an extent at a time. */
+  end = bytes_to_sectors (offset + size);
+  for (idx = offset / BLOCK_SECTOR_SIZE; idx < end; idx += e.length - ofs)
+    {
+      extent_find (&inode->data, idx, &e, &ofs);
+      if (e.start == NO_SECTOR)
+        return true;
+    }
+  return false;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs.  Writing past end of file
+   extends INODE, with zeros in any gap; if the disk fills up the
+   write stops at the old end of file.  Readers do not see the
+   new length until the whole write is done.
+   The contents of directories and of the free map are metadata,
+   and are logged like the inode itself. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool journaled = false;
+  bool extending;
+  bool metadata;
 
+  /* Only a write that logs needs a journal operation.  Telling
+     takes the inode's lock, under which journal_begin() may not
+     wait, so a write that turns out to need one starts over in
+     one. */
+  lock_acquire (&inode->lock);
+  while (!journaled && !inode->deny_write_cnt
+         && write_logs (inode, offset, size))
+    {
+      lock_release (&inode->lock);
+      journal_begin (INODE_LOG_MAX);
+      journaled = true;
+      lock_acquire (&inode->lock);
+    }
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      lock_release (&inode->lock);
+      if (journaled)
+        journal_end ();
+      return 0;
+    }
+  metadata = inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+
+  /* Growing files get sectors to spare, as many again as they
+     need, so that a run of appends lands in a few long runs of
+     sectors.  Metadata gets none, so that closing a directory
+     never trims it, which may happen in an operation that did not
+     reserve room for that.  Sectors wholly in a gap before OFFSET
+     are left as a hole, and new sectors come zeroed.  Even a
+     failed extension may have moved inline data out, so the inode
+     is written back either way. */
+  extending = offset + size > inode->data.length;
+  if (extending)
+    {
+      size_t extra = metadata ? 0 : bytes_to_sectors (offset + size);
+
+      inode_extend (&inode->data, offset + size, offset / BLOCK_SECTOR_SIZE,
+                    extra < PREALLOC_MAX ? extra : PREALLOC_MAX);
+    }
+
+  /* A small file is written in the inode, with the inode. */
+  if (is_inline (&inode->data))
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_written = inode->data.length - offset;
+          if (bytes_written > size)
+            bytes_written = size;
+          memcpy (inode->data.contents + offset, buffer, bytes_written);
+        }
+      if (extending || bytes_written > 0)
+        cache_log_at (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+      lock_release (&inode->lock);
+      if (journaled)
+        journal_end ();
+      return bytes_written;
+    }
+
+  if (extending)
+    cache_log_at (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  else
+    lock_release (&inode->lock);
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int min_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      int chunk_size;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+      /* A sector in a hole is allocated before it is written. */
+      if (!extending)
+        lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      inode_left = inode->data.length - offset;
+      min_left = inode_left < sector_left ? inode_left : sector_left;
+      chunk_size = size < min_left ? size : min_left;
+      if (chunk_size > 0 && sector_idx == NO_SECTOR)
+        sector_idx = inode_fill (inode, offset / BLOCK_SECTOR_SIZE);
+      if (!extending)
+        lock_release (&inode->lock);
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      if (chunk_size <= 0 || sector_idx == NO_SECTOR)
+        break;
+
+      if (metadata)
+        cache_log_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
+      else
+        cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                        chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  if (extending)
+    lock_release (&inode->lock);
+  if (journaled)
+    journal_end ();
   return bytes_written;
 }
 
@@ -322,8 +1105,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +1117,23 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->lock);
+}
+
+/* Returns true if some opener of INODE has denied writes to it. */
+bool
+inode_is_write_denied (struct inode *inode)
+{
+  bool denied;
+
+  lock_acquire (&inode->lock);
+  denied = inode->deny_write_cnt > 0;
+  lock_release (&inode->lock);
+  return denied;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -0,0 +1,322 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata changes are logged in the buffer cache and committed
+   to the journal in batches, each of whatever every operation
+   finished since the last one changed: first a header listing the
+   sectors, then their contents, then a commit record.  Only then
+   may the sectors be written to their homes, which the cache does
+   in its own time; before the next batch overwrites the journal,
+   the last one is made sure to be home.  After a crash, a batch
+   with its commit record is copied home again, and one without is
+   ignored, so each batch happens entirely or not at all.
+
+   Logged sectors stay in the cache until they are committed, and a
+   commit waits for the operations under way, so each operation
+   says up front how many sectors it may log at most.  It only
+   starts once the batch has room for that many on top of what is
+   logged and reserved already, committing first if need be.  Once
+   the commit has its snapshot of the batch, new operations log
+   into the next one while it writes. */
+
+/* Time between commits, in timer ticks. */
+#define COMMIT_INTERVAL TIMER_FREQ
+
+/* Identify a journal header and a commit record. */
+#define HEADER_MAGIC 0x4a524e4c
+#define COMMIT_MAGIC 0x434d4954
+
+/* First sector of the journal.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* HEADER_MAGIC. */
+    uint32_t seq;                       /* Batch number. */
+    uint32_t cnt;                       /* Number of sectors logged. */
+    block_sector_t sectors[CACHE_LOG_MAX]; /* Homes of logged sectors. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12 - 4 * CACHE_LOG_MAX];
+  };
+
+/* Follows the logged sectors of a complete batch.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct commit_record
+  {
+    unsigned magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Batch number, as in header. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+/* A batch of logged sectors. */
+struct batch
+  {
+    size_t cnt;                         /* Number of sectors. */
+    block_sector_t sectors[CACHE_LOG_MAX]; /* Their homes. */
+    uint8_t *data;                      /* Their contents, in order. */
+  };
+
+/* The batch being committed and the last one committed, which
+   may not be home yet. */
+static struct batch batches[2];
+static struct batch *last;
+static uint32_t seq;
+
+/* Sectors a batch may log, short of the free map's, which each
+   commit adds. */
+static size_t room;
+
+/* Operations in progress and the sectors they reserved, whether a
+   commit is under way, and whether it has yet to take its
+   snapshot, until which no more operations may start. */
+static int active;
+static size_t reserved;
+static bool committing;
+static bool draining;
+static struct lock journal_lock;
+static struct condition idle;           /* Signaled when ACTIVE drops to 0. */
+static struct condition changed;        /* Broadcast when a commit or
+                                           an operation ends. */
+
+static void checkpoint (const struct batch *);
+static void write_batch (const struct batch *);
+static thread_func commit_daemon NO_RETURN;
+
+/* Initializes the journal and starts its committing thread. */
+void
+journal_init (void)
+{
+  int i;
+
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct commit_record) == BLOCK_SECTOR_SIZE);
+
+  for (i = 0; i < 2; i++)
+    {
+      batches[i].data = malloc (CACHE_LOG_MAX * BLOCK_SECTOR_SIZE);
+      if (batches[i].data == NULL)
+        PANIC ("journal allocation failed");
+    }
+  if (free_map_sectors () >= CACHE_LOG_MAX)
+    PANIC ("file system device too large for the journal");
+  room = CACHE_LOG_MAX - free_map_sectors ();
+  lock_init (&journal_lock);
+  cond_init (&idle);
+  cond_init (&changed);
+
+  thread_create ("journal", PRI_DEFAULT, commit_daemon, NULL);
+}
+
+/* Writes an empty journal, at format time. */
+void
+journal_format (void)
+{
+  static struct journal_header header;
+
+  header.magic = HEADER_MAGIC;
+  header.seq = seq = 0;
+  header.cnt = 0;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Copies the batch in the journal home, if it was committed.  Must
+   be called before anything else reads the file system. */
+void
+journal_replay (void)
+{
+  static struct journal_header header;
+  static struct commit_record record;
+  uint32_t i;
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != HEADER_MAGIC || header.cnt > CACHE_LOG_MAX)
+    return;
+  seq = header.seq;
+  if (header.cnt == 0)
+    return;
+
+  block_read (fs_device, JOURNAL_SECTOR + 1 + header.cnt, &record);
+  if (record.magic == COMMIT_MAGIC && record.seq == header.seq)
+    for (i = 0; i < header.cnt; i++)
+      {
+        block_read (fs_device, JOURNAL_SECTOR + 1 + i, batches[0].data);
+        block_write (fs_device, header.sectors[i], batches[0].data);
+      }
+
+  /* Otherwise a later boot would copy it home over later
+     changes. */
+  header.cnt = 0;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Starts an operation whose metadata changes must be committed
+   together, which logs at most SECTORS distinct sectors.
+   Operations nest: only the outermost counts, and its SECTORS must
+   cover the nested ones.  Waits while a commit is under way or the
+   batch lacks room, so the caller must hold no file system lock
+   unless it is in an operation already. */
+void
+journal_begin (size_t sectors)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+  ASSERT (sectors <= room);
+
+  /* Sectors logged by operations under way count against their
+     reservations as well, which errs on the safe side.  So do
+     those of a batch being written, until it is committed. */
+  lock_acquire (&journal_lock);
+  while (draining || cache_logged_cnt () + reserved + sectors > room)
+    if (!committing && active == 0)
+      {
+        /* Only the batch is in the way. */
+        lock_release (&journal_lock);
+        t->journal_depth--;
+        journal_commit ();
+        t->journal_depth++;
+        lock_acquire (&journal_lock);
+      }
+    else
+      cond_wait (&changed, &journal_lock);
+  active++;
+  reserved += sectors;
+  t->journal_reserved = sectors;
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation started by journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  reserved -= t->journal_reserved;
+  if (--active == 0)
+    cond_signal (&idle, &journal_lock);
+  cond_broadcast (&changed, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Commits every metadata change logged so far, once the
+   operations under way are done.  Returns when the batch is in
+   the journal.  Must not be called inside an operation. */
+void
+journal_commit (void)
+{
+  struct thread *t = thread_current ();
+  struct batch *b;
+
+  ASSERT (t->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&changed, &journal_lock);
+  committing = draining = true;
+  while (active > 0)
+    cond_wait (&idle, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* The free map's changes join the batch.  Writing them is part
+     of the batch, not an operation of its own.  Sectors released
+     are shown free in it, but stay in use until the batch is
+     committed. */
+  t->journal_depth++;
+  free_map_flush ();
+  t->journal_depth--;
+
+  b = last == &batches[0] ? &batches[1] : &batches[0];
+  b->cnt = cache_snapshot (b->sectors, b->data);
+
+  lock_acquire (&journal_lock);
+  draining = false;
+  cond_broadcast (&changed, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (b->cnt > 0)
+    {
+      checkpoint (b);
+      write_batch (b);
+      cache_unlog ();
+      last = b;
+    }
+
+  /* Sectors the batch released may be reused now. */
+  free_map_commit ();
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&changed, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Makes sure the last batch committed is home, before B takes its
+   place in the journal.  A sector logged again since then, in B or
+   in the batch after it, is written from the copy in the last
+   batch, since the cache holds newer contents not committed
+   yet. */
+static void
+checkpoint (const struct batch *b)
+{
+  size_t i, j;
+
+  if (last == NULL)
+    return;
+
+  for (i = 0; i < last->cnt; i++)
+    {
+      for (j = 0; j < b->cnt; j++)
+        if (b->sectors[j] == last->sectors[i])
+          break;
+      if (j < b->cnt || !cache_write_back (last->sectors[i]))
+        block_write (fs_device, last->sectors[i],
+                     last->data + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Writes B to the journal, the commit record last. */
+static void
+write_batch (const struct batch *b)
+{
+  static struct journal_header header;
+  static struct commit_record record;
+  size_t i;
+
+  header.magic = HEADER_MAGIC;
+  header.seq = ++seq;
+  header.cnt = b->cnt;
+  memcpy (header.sectors, b->sectors, b->cnt * sizeof *b->sectors);
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+
+  for (i = 0; i < b->cnt; i++)
+    block_write (fs_device, JOURNAL_SECTOR + 1 + i,
+                 b->data + i * BLOCK_SECTOR_SIZE);
+
+  record.magic = COMMIT_MAGIC;
+  record.seq = seq;
+  block_write (fs_device, JOURNAL_SECTOR + 1 + b->cnt, &record);
+}
+
+/* Commits every COMMIT_INTERVAL, so that changes become durable
+   in batches. */
+static void
+commit_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      journal_commit ();
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include "filesys/cache.h"
+
+/* Sectors of the journal: a header, the logged sectors and a
+   commit record. */
+#define JOURNAL_SECTOR 2
+#define JOURNAL_SECTORS (CACHE_LOG_MAX + 2)
+
+void journal_init (void);
+void journal_format (void);
+void journal_replay (void);
+void journal_begin (size_t sectors);
+void journal_end (void);
+void journal_commit (void);
+
+#endif /* filesys/journal.h */
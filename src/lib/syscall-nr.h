@@ -28,7 +28,16 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Clone the current process. */
+    SYS_MADVISE,                /* Give access hints for a memory range. */
+    SYS_MSYNC,                  /* Write a memory mapping back to its file. */
+    SYS_GETRUSAGE,              /* Get memory and fault statistics. */
+    SYS_SETRSS,                 /* Limit the pages kept in memory. */
+    SYS_PREAD,                  /* Read from a file at a given offset. */
+    SYS_PWRITE                  /* Write to a file at a given offset. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -61,6 +61,25 @@
           retval;                                               \
         })
 
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; "                   \
+             "pushl %[arg1]; pushl %[arg0]; "                   \
+             "pushl %[number]; int $0x30; addl $20, %%esp"      \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1),                             \
+                 [arg2] "g" (ARG2),                             \
+                 [arg3] "g" (ARG3)                              \
+               : "memory");                                     \
+          retval;                                               \
+        })
+
 void
 halt (void) 
 {
@@ -182,3 +201,45 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+int
+madvise (void *addr, size_t length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+bool
+msync (mapid_t mapid)
+{
+  return syscall1 (SYS_MSYNC, mapid);
+}
+
+int
+getrusage (struct rusage *usage)
+{
+  return syscall1 (SYS_GETRUSAGE, usage);
+}
+
+bool
+setrss (int pages)
+{
+  return syscall1 (SYS_SETRSS, pages);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, int offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, int offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
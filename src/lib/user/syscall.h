@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -12,6 +13,29 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Access hints for madvise(). */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_RANDOM 1           /* Expect random access: no read-ahead. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential access. */
+#define MADV_WILLNEED 3         /* Will be accessed soon: read it in. */
+#define MADV_DONTNEED 4         /* Won't be accessed: drop it. */
+
+/* Memory and fault statistics from getrusage(). */
+struct rusage
+  {
+    unsigned resident;          /* Pages in memory. */
+    unsigned swapped;           /* Pages in swap. */
+    unsigned major_faults;      /* Faults that had to read the disk. */
+    unsigned minor_faults;      /* Faults served from memory. */
+    unsigned evictions;         /* Pages taken away by eviction. */
+    unsigned swap_ins;          /* Pages read back from swap. */
+    unsigned write_backs;       /* Mapped pages written back to their files. */
+  };
+
+/* Arguments to setrss() besides a number of pages. */
+#define RSS_UNLIMITED 0         /* No limit. */
+#define RSS_AUTO (-1)           /* Follow the working set. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -45,4 +69,13 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+pid_t fork (void);
+int madvise (void *addr, size_t length, int advice);
+bool msync (mapid_t);
+int getrusage (struct rusage *);
+bool setrss (int pages);
+int pread (int fd, void *buffer, unsigned length, int offset);
+int pwrite (int fd, const void *buffer, unsigned length, int offset);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,62 @@
+/* Creates enough files in a subdirectory for its buckets to
+   split and its index to grow, then finds each by relative and
+   absolute path, lists them, and removes them and the
+   directory. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 300
+
+void
+test_main (void) 
+{
+  char name[32], entry[READDIR_MAX_LEN + 1];
+  int fd, cnt, i;
+
+  CHECK (mkdir ("/many"), "mkdir \"/many\"");
+  CHECK (chdir ("many"), "chdir \"many\"");
+
+  msg ("creating %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, i))
+        fail ("create \"%s\" failed", name);
+    }
+
+  msg ("opening them");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, i % 2 ? "file%d" : "/many/file%d", i);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\" failed", name);
+      if (filesize (fd) != i)
+        fail ("\"%s\" is %d bytes, not %d", name, filesize (fd), i);
+      close (fd);
+    }
+
+  CHECK ((fd = open (".")) > 1, "open \".\"");
+  CHECK (isdir (fd), "isdir \".\"");
+  for (cnt = 0; readdir (fd, entry); cnt++)
+    continue;
+  if (cnt != FILE_CNT)
+    fail ("readdir found %d entries, not %d", cnt, FILE_CNT);
+  msg ("readdir found %d entries", cnt);
+  close (fd);
+
+  CHECK (!remove ("/many"), "remove \"/many\" (must fail)");
+  msg ("removing them");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  CHECK (chdir (".."), "chdir \"..\"");
+  CHECK (remove ("many"), "remove \"many\"");
+  CHECK (open ("/many") == -1, "open \"/many\" (must return -1)");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-many) begin
+(dir-many) mkdir "/many"
+(dir-many) chdir "many"
+(dir-many) creating 300 files
+(dir-many) opening them
+(dir-many) open "."
+(dir-many) isdir "."
+(dir-many) readdir found 300 entries
+(dir-many) remove "/many" (must fail)
+(dir-many) removing them
+(dir-many) chdir ".."
+(dir-many) remove "many"
+(dir-many) open "/many" (must return -1)
+(dir-many) end
+EOF
+pass;
@@ -0,0 +1,26 @@
+/* Grows a file from empty, one odd-sized block at a time, so that
+   its last extent keeps growing and new extents are added as the
+   sectors after it run out, then reads it back to verify that it
+   was written properly. */
+
+#include "tests/filesys/seq-test.h"
+#include "tests/main.h"
+
+#define TEST_SIZE 150000
+#define BLOCK_SIZE 1234
+
+static char buf[TEST_SIZE];
+
+static size_t
+return_block_size (void) 
+{
+  return BLOCK_SIZE;
+}
+
+void
+test_main (void) 
+{
+  seq_test ("zucchini",
+            buf, sizeof buf, 0,
+            return_block_size, NULL);
+}
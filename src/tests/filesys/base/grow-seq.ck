@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-seq) begin
+(grow-seq) create "zucchini"
+(grow-seq) open "zucchini"
+(grow-seq) writing "zucchini"
+(grow-seq) close "zucchini"
+(grow-seq) open "zucchini" for verification
+(grow-seq) verified contents of "zucchini"
+(grow-seq) close "zucchini"
+(grow-seq) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+/* Writes and reads back a file at random offsets with pwrite()
+   and pread(), and checks that they leave the file position
+   alone.  Compare with seek-bench. */
+
+#define USE_PREAD
+#include "tests/filesys/base/rw-bench.inc"
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pread-bench) begin
+(pread-bench) create "bench"
+(pread-bench) open "bench"
+(pread-bench) write "bench" in random order
+(pread-bench) read "bench" in random order 20 times
+(pread-bench) close "bench"
+(pread-bench) end
+EOF
+pass;
@@ -0,0 +1,4 @@
+/* Writes and reads back a file at random offsets with seek()
+   followed by write() or read().  Compare with pread-bench. */
+
+#include "tests/filesys/base/rw-bench.inc"
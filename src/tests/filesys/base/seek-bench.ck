@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(seek-bench) begin
+(seek-bench) create "bench"
+(seek-bench) open "bench"
+(seek-bench) write "bench" in random order
+(seek-bench) read "bench" in random order 20 times
+(seek-bench) close "bench"
+(seek-bench) end
+EOF
+pass;
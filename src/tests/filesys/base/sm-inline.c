@@ -0,0 +1,52 @@
+/* Writes a small file a piece at a time up to the most that fits
+   in its inode, 480 bytes, then one byte past that, which moves
+   the data out to a sector of its own, and checks the contents
+   after each step.  Then writes a second file with a single write
+   across the limit. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define INLINE_MAX 480
+
+static char buf[INLINE_MAX + 32];
+
+static void
+write_at (int fd, const char *file_name, int ofs, int size)
+{
+  seek (fd, ofs);
+  CHECK (write (fd, buf + ofs, size) == size,
+         "write %d bytes at %d to \"%s\"", size, ofs, file_name);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("kumquat", 0), "create \"kumquat\"");
+  CHECK ((fd = open ("kumquat")) > 1, "open \"kumquat\"");
+  write_at (fd, "kumquat", 0, 300);
+  write_at (fd, "kumquat", 300, INLINE_MAX - 300);
+  seek (fd, 0);
+  check_file_handle (fd, "kumquat", buf, INLINE_MAX);
+  write_at (fd, "kumquat", INLINE_MAX, 1);
+  seek (fd, 0);
+  check_file_handle (fd, "kumquat", buf, INLINE_MAX + 1);
+  msg ("close \"kumquat\"");
+  close (fd);
+  check_file ("kumquat", buf, INLINE_MAX + 1);
+
+  CHECK (create ("loquat", 0), "create \"loquat\"");
+  CHECK ((fd = open ("loquat")) > 1, "open \"loquat\"");
+  write_at (fd, "loquat", 0, INLINE_MAX - 10);
+  write_at (fd, "loquat", INLINE_MAX - 20, 40);
+  msg ("close \"loquat\"");
+  close (fd);
+  check_file ("loquat", buf, INLINE_MAX + 20);
+}
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sm-inline) begin
+(sm-inline) create "kumquat"
+(sm-inline) open "kumquat"
+(sm-inline) write 300 bytes at 0 to "kumquat"
+(sm-inline) write 180 bytes at 300 to "kumquat"
+(sm-inline) verified contents of "kumquat"
+(sm-inline) write 1 bytes at 480 to "kumquat"
+(sm-inline) verified contents of "kumquat"
+(sm-inline) close "kumquat"
+(sm-inline) open "kumquat" for verification
+(sm-inline) verified contents of "kumquat"
+(sm-inline) close "kumquat"
+(sm-inline) create "loquat"
+(sm-inline) open "loquat"
+(sm-inline) write 470 bytes at 0 to "loquat"
+(sm-inline) write 40 bytes at 460 to "loquat"
+(sm-inline) close "loquat"
+(sm-inline) open "loquat" for verification
+(sm-inline) verified contents of "loquat"
+(sm-inline) close "loquat"
+(sm-inline) end
+EOF
+pass;
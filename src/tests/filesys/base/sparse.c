@@ -0,0 +1,47 @@
+/* Seeks well past the end of an empty file and writes there,
+   leaving a hole, then checks that the file has grown to cover
+   the write, that the hole reads back as zeros and the data as
+   written.  Then fills in part of the hole and checks again. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOLE_SIZE 200000
+#define DATA_SIZE 1234
+#define FILL_OFS 70000
+
+static char buf[HOLE_SIZE + DATA_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "quince";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf + HOLE_SIZE, DATA_SIZE);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\" to %d", file_name, HOLE_SIZE);
+  seek (fd, HOLE_SIZE);
+  CHECK (write (fd, buf + HOLE_SIZE, DATA_SIZE) == DATA_SIZE,
+         "write %d bytes to \"%s\"", DATA_SIZE, file_name);
+  CHECK (filesize (fd) == HOLE_SIZE + DATA_SIZE,
+         "filesize \"%s\" is %d", file_name, HOLE_SIZE + DATA_SIZE);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+
+  random_bytes (buf + FILL_OFS, DATA_SIZE);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\" to %d", file_name, FILL_OFS);
+  seek (fd, FILL_OFS);
+  CHECK (write (fd, buf + FILL_OFS, DATA_SIZE) == DATA_SIZE,
+         "write %d bytes to \"%s\"", DATA_SIZE, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
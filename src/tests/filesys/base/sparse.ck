@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sparse) begin
+(sparse) create "quince"
+(sparse) open "quince"
+(sparse) seek "quince" to 200000
+(sparse) write 1234 bytes to "quince"
+(sparse) filesize "quince" is 201234
+(sparse) close "quince"
+(sparse) open "quince" for verification
+(sparse) verified contents of "quince"
+(sparse) close "quince"
+(sparse) open "quince"
+(sparse) seek "quince" to 70000
+(sparse) write 1234 bytes to "quince"
+(sparse) close "quince"
+(sparse) open "quince" for verification
+(sparse) verified contents of "quince"
+(sparse) close "quince"
+(sparse) end
+EOF
+pass;
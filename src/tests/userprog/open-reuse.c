@@ -0,0 +1,33 @@
+/* Opens three files and closes the middle one.  The next open()
+   must return the file descriptor just closed, and reading from
+   it must read the newly opened file. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char contents[] = "fresh file contents\n";
+
+void
+test_main (void) 
+{
+  int h1, h2, h3, h4;
+
+  CHECK (create ("fresh", sizeof contents - 1), "create \"fresh\"");
+  CHECK ((h1 = open ("fresh")) > 1, "open \"fresh\"");
+  CHECK (write (h1, contents, sizeof contents - 1)
+         == (int) sizeof contents - 1, "write \"fresh\"");
+  msg ("close \"fresh\"");
+  close (h1);
+
+  CHECK ((h1 = open ("sample.txt")) > 1, "open \"sample.txt\" once");
+  CHECK ((h2 = open ("sample.txt")) > 1, "open \"sample.txt\" again");
+  CHECK ((h3 = open ("sample.txt")) > 1, "open \"sample.txt\" a third time");
+  msg ("close the second");
+  close (h2);
+
+  CHECK ((h4 = open ("fresh")) > 1, "open \"fresh\"");
+  if (h4 != h2)
+    fail ("open() returned %d, not the closed %d", h4, h2);
+  check_file_handle (h4, "fresh", contents, sizeof contents - 1);
+}
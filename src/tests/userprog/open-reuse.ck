@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(open-reuse) begin
+(open-reuse) create "fresh"
+(open-reuse) open "fresh"
+(open-reuse) write "fresh"
+(open-reuse) close "fresh"
+(open-reuse) open "sample.txt" once
+(open-reuse) open "sample.txt" again
+(open-reuse) open "sample.txt" a third time
+(open-reuse) close the second
+(open-reuse) open "fresh"
+(open-reuse) verified contents of "fresh"
+(open-reuse) end
+open-reuse: exit(0)
+EOF
+pass;
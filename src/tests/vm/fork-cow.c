@@ -0,0 +1,45 @@
+/* Forks with a large buffer in memory, then has the child
+   overwrite it.  The child must see its own writes and the parent
+   must still see the original contents afterwards. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/cksum.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  unsigned long init;
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i * 257;
+  init = cksum (buf, sizeof buf);
+
+  child = fork ();
+  if (child == 0)
+    {
+      memset (buf, 0x5a, sizeof buf);
+      for (i = 0; i < sizeof buf; i++)
+        if (buf[i] != 0x5a)
+          fail ("child reads %02hhx at offset %zu", buf[i], i);
+      msg ("child wrote its copy");
+      exit (81);
+    }
+
+  /* Print nothing until the child is done, so the output is in order */
+  if (child == -1)
+    fail ("fork");
+  if (wait (child) != 81)
+    fail ("wait for child");
+  if (cksum (buf, sizeof buf) != init)
+    fail ("parent's copy changed by child");
+  msg ("parent's copy intact");
+}
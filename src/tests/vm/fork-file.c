@@ -0,0 +1,40 @@
+/* Forks with a file open.  The child reads from it, and the
+   parent's next read must pick up where the child's left off,
+   since the two share the open file and its position. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK 100
+
+void
+test_main (void)
+{
+  char buf[CHUNK];
+  pid_t child;
+  int handle;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  child = fork ();
+  if (child == 0)
+    {
+      if (read (handle, buf, CHUNK) != CHUNK
+          || memcmp (buf, sample, CHUNK))
+        exit (-1);
+      exit (81);
+    }
+
+  if (child == -1)
+    fail ("fork");
+  CHECK (wait (child) == 81, "child reads the first %d bytes", CHUNK);
+  CHECK (tell (handle) == CHUNK, "position moved for the parent too");
+  if (read (handle, buf, CHUNK) != CHUNK)
+    fail ("read \"sample.txt\"");
+  if (memcmp (buf, sample + CHUNK, CHUNK))
+    fail ("parent did not read on from the child's position");
+  msg ("parent reads the next %d bytes", CHUNK);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-file) begin
+(fork-file) open "sample.txt"
+(fork-file) child reads the first 100 bytes
+(fork-file) position moved for the parent too
+(fork-file) parent reads the next 100 bytes
+(fork-file) end
+EOF
+pass;
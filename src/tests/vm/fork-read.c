@@ -0,0 +1,47 @@
+/* Forks, then has the child read() a file into a buffer it shares
+   copy-on-write with its parent.  The kernel's stores into the
+   buffer must give the child its own copy like the child's own
+   stores would. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2 * 4096];
+
+void
+test_main (void)
+{
+  pid_t child;
+  int handle;
+  size_t i;
+
+  memset (buf, 'x', sizeof buf);
+
+  child = fork ();
+  if (child == 0)
+    {
+      /* Straddle a page boundary */
+      char *dst = buf + 4096 - 100;
+
+      CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+      if (read (handle, dst, sizeof sample - 1) != (int) sizeof sample - 1)
+        fail ("read \"sample.txt\"");
+      if (memcmp (dst, sample, sizeof sample - 1))
+        fail ("child read bad data");
+      close (handle);
+      exit (82);
+    }
+
+  /* Print nothing until the child is done, so the output is in order */
+  if (child == -1)
+    fail ("fork");
+  if (wait (child) != 82)
+    fail ("wait for child");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 'x')
+      fail ("parent's buffer changed at offset %zu", i);
+  msg ("parent's buffer intact");
+}
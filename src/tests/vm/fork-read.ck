@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-read) begin
+(fork-read) open "sample.txt"
+(fork-read) parent's buffer intact
+(fork-read) end
+EOF
+pass;
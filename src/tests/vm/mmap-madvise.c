@@ -0,0 +1,45 @@
+/* Gives each access hint for a mapping, then checks that
+   MADV_DONTNEED wrote the modified page back to the file and
+   that the mapping still reads correctly afterwards. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  char buf[1024];
+
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+
+  CHECK (madvise (ACTUAL, strlen (sample), MADV_SEQUENTIAL) == 0,
+         "madvise MADV_SEQUENTIAL");
+  CHECK (madvise (ACTUAL, strlen (sample), MADV_WILLNEED) == 0,
+         "madvise MADV_WILLNEED");
+  memcpy (ACTUAL, sample, strlen (sample));
+
+  CHECK (madvise (ACTUAL, strlen (sample), MADV_DONTNEED) == 0,
+         "madvise MADV_DONTNEED");
+  read (handle, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare read data against written data");
+  CHECK (!memcmp (ACTUAL, sample, strlen (sample)),
+         "compare mapping against written data");
+
+  CHECK (madvise (ACTUAL, strlen (sample), MADV_RANDOM) == 0,
+         "madvise MADV_RANDOM");
+  CHECK (madvise ((char *) ACTUAL + 0x100000, 1, MADV_NORMAL) == -1,
+         "madvise unmapped memory (must return -1)");
+
+  munmap (map);
+  close (handle);
+}
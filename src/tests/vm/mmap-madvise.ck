@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) create "sample.txt"
+(mmap-madvise) open "sample.txt"
+(mmap-madvise) mmap "sample.txt"
+(mmap-madvise) madvise MADV_SEQUENTIAL
+(mmap-madvise) madvise MADV_WILLNEED
+(mmap-madvise) madvise MADV_DONTNEED
+(mmap-madvise) compare read data against written data
+(mmap-madvise) compare mapping against written data
+(mmap-madvise) madvise MADV_RANDOM
+(mmap-madvise) madvise unmapped memory (must return -1)
+(mmap-madvise) end
+EOF
+pass;
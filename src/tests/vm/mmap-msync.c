@@ -0,0 +1,43 @@
+/* Writes to a file through a mapping and flushes it with msync,
+   twice, checking the file contents with read after each flush
+   while the mapping stays in place. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  char *actual = ACTUAL;
+  int handle;
+  mapid_t map;
+  char buf[1024];
+
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+
+  memcpy (actual, sample, strlen (sample));
+  CHECK (msync (map), "msync \"sample.txt\"");
+  seek (handle, 0);
+  read (handle, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare read data against written data");
+
+  /* A single byte in the second sector */
+  actual[600] = 'X';
+  CHECK (msync (map), "msync \"sample.txt\" again");
+  seek (handle, 0);
+  read (handle, buf, strlen (sample));
+  CHECK (buf[600] == 'X' && !memcmp (buf, sample, 600)
+         && !memcmp (buf + 601, sample + 601, strlen (sample) - 601),
+         "compare read data against changed data");
+
+  munmap (map);
+  close (handle);
+}
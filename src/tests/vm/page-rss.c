@@ -0,0 +1,40 @@
+/* Limits the process to a few pages of memory, then writes and
+   reads back a buffer many times that size.  The process has to
+   replace its own pages and must never go over its limit. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define LIMIT 32
+#define PAGES 128
+
+static char buf[PAGES * 4096];
+
+void
+test_main (void)
+{
+  struct rusage usage;
+  size_t i;
+
+  CHECK (!setrss (LIMIT / 4), "setrss below the minimum fails");
+  CHECK (setrss (LIMIT), "setrss %d", LIMIT);
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i % 251;
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu is %02hhx", i, buf[i]);
+
+  CHECK (getrusage (&usage) == 0, "getrusage");
+  if (usage.resident > LIMIT)
+    fail ("%u pages resident with a limit of %d", usage.resident, LIMIT);
+  if (usage.evictions == 0)
+    fail ("no pages evicted");
+
+  CHECK (setrss (RSS_AUTO), "setrss RSS_AUTO");
+  for (i = 0; i < sizeof buf; i += 4096)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu is %02hhx", i, buf[i]);
+  msg ("data intact");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-rss) begin
+(page-rss) setrss below the minimum fails
+(page-rss) setrss 32
+(page-rss) getrusage
+(page-rss) setrss RSS_AUTO
+(page-rss) data intact
+(page-rss) end
+EOF
+pass;
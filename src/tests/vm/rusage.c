@@ -0,0 +1,48 @@
+/* Touches pages of zeroed memory and of a mapped file, and checks
+   that getrusage() counts the faults and the resident pages. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGES 16
+
+static char buf[(PAGES + 1) * 4096];
+
+void
+test_main (void)
+{
+  struct rusage before, after;
+  char *pages = (char *) (((uintptr_t) buf + 4095) & ~4095);
+  char *actual = (char *) 0x10000000;
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  CHECK (getrusage (&before) == 0, "getrusage");
+  for (i = 0; i < PAGES; i++)
+    pages[i * 4096] = 1;
+  CHECK (getrusage (&after) == 0, "getrusage");
+  if (after.minor_faults - before.minor_faults < PAGES)
+    fail ("%u minor faults for %d new pages",
+          after.minor_faults - before.minor_faults, PAGES);
+  if (after.resident - before.resident < PAGES)
+    fail ("%u more pages resident after touching %d",
+          after.resident - before.resident, PAGES);
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED, "mmap \"sample.txt\"");
+  before = after;
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  CHECK (getrusage (&after) == 0, "getrusage");
+  if (after.major_faults == before.major_faults)
+    fail ("reading a mapped file took no major fault");
+  msg ("counts look right");
+
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(rusage) begin
+(rusage) getrusage
+(rusage) getrusage
+(rusage) open "sample.txt"
+(rusage) mmap "sample.txt"
+(rusage) getrusage
+(rusage) counts look right
+(rusage) end
+EOF
+pass;
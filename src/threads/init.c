@@ -15,6 +15,7 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -41,6 +42,10 @@
 #include "vm/swap.h"
 #endif
 
+/* 4 MB page support: CPUID leaf 1 EDX bit, and CR4 enable bit. */
+#define CPUID_PSE 0x00000008    /* Page Size Extension supported. */
+#define CR4_PSE   0x00000010    /* Page Size Extension enabled. */
+
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
@@ -62,6 +67,7 @@ static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pse (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -160,12 +166,17 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+   If the CPU supports it, every whole 4 MB of RAM that holds no
+   kernel text is mapped by a single 4 MB page, which needs no page
+   table and only one TLB entry. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
+  uint32_t cr4;
   size_t page;
+  bool pse = cpu_has_pse ();
   extern char _start, _end_kernel_text;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -178,6 +189,16 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      /* Kernel text stays read-only, so its 4 MB keeps a page table */
+      if (pse && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && !(vaddr < &_end_kernel_text && &_start < vaddr + PTSPAN))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true);
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -187,6 +208,12 @@ paging_init (void)
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
     }
 
+  /* 4 MB PDEs are only honoured with CR4.PSE set.  See [IA32-v3a]
+     3.7.3 "Mixing 4-KByte and 4-MByte Pages". */
+  if (pse)
+    asm volatile ("movl %%cr4, %0; orl %1, %0; movl %0, %%cr4"
+                  : "=&r" (cr4) : "i" (CR4_PSE));
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -195,6 +222,28 @@ paging_init (void)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
+/* Returns true if the CPU supports 4 MB pages, according to
+   CPUID.  CPUs too old to have CPUID don't. */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t flags, toggled;
+  uint32_t eax, ebx, ecx, edx;
+
+  /* CPUID exists iff the ID flag in EFLAGS can be changed.  See
+     [IA32-v2a] "CPUID--CPU Identification". */
+  asm volatile ("pushfl; popl %0; movl %0, %1; xorl %2, %1; "
+                "pushl %1; popfl; pushfl; popl %1; pushl %0; popfl"
+                : "=&r" (flags), "=&r" (toggled) : "i" (FLAG_ID) : "cc");
+  if (((flags ^ toggled) & FLAG_ID) == 0)
+    return false;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return (edx & CPUID_PSE) != 0;
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **
@@ -266,6 +315,8 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-vmstats"))
+        process_vmstats = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -388,6 +439,7 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -vmstats           Print memory statistics of each process at exit.\n"
 #endif
           );
   shutdown_power_off ();
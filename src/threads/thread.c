@@ -14,6 +14,9 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#ifdef FILESYS
+#include "filesys/directory.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
    Used to detect stack overflow.  See the big comment at the top
@@ -184,6 +187,12 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
 
+#ifdef FILESYS
+  /* Start in the creator's current directory. */
+  if (thread_current ()->cwd != NULL)
+    t->cwd = dir_reopen (thread_current ()->cwd);
+#endif
+
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack' 
      member cannot be observed. */
@@ -471,6 +480,8 @@ init_thread (struct thread *t, const char *name, int priority)
   #ifdef USERPROG
   t->process = NULL; /* We have no process yet - gets set in start_process */
   list_init(&t->children);
+  t->tlb_batch = NULL;
+  t->user_esp = NULL;
   #endif
   t->magic = THREAD_MAGIC;
   list_push_back (&all_list, &t->allelem);
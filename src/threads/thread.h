@@ -102,6 +102,16 @@ struct thread
     uint32_t *pagedir;                  /* Page directory. */
     struct process* process;            /* This thread's associated process */
     struct list children;               /* This thread's child _processes_ */
+    struct pagedir_batch *tlb_batch;    /* Deferred TLB invalidations, if any */
+    void *user_esp;                     /* User stack pointer in a system call */
+#endif
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Current directory, or NULL for the root */
+
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal_begin() calls */
+    size_t journal_reserved;            /* Sectors the outermost reserved */
 #endif
 
     /* Owned by thread.c. */
@@ -12,10 +12,19 @@
 #include "vm/page.h"
 #include "vm/swap.h"
 #include "vm/frame.h"
+#include "userprog/uaccess.h"
+#include "devices/timer.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* Histograms of how long each phase of a page fault took: bucket N
+   counts the times it took from 2**N up to 2**(N+1) - 1 cycles. */
+#define PHASE_BUCKETS 64
+static long long phase_hist[FAULT_PHASE_CNT][PHASE_BUCKETS];
+static const char* phase_names[FAULT_PHASE_CNT] =
+  { "lookup", "eviction", "swap-in", "file read" };
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 static void page_fault_error (struct intr_frame *f, void* fault_addr, bool not_present, bool write, bool user);
@@ -73,6 +82,36 @@ void
 exception_print_stats (void) 
 {
   //printf ("Exception: %lld page faults\n", page_fault_cnt);
+  int phase, i;
+
+  for (phase = 0; phase < FAULT_PHASE_CNT; phase++)
+    {
+      printf ("Fault %s (log2 cycles: count):", phase_names[phase]);
+      for (i = 0; i < PHASE_BUCKETS; i++)
+        if (phase_hist[phase][i] != 0)
+          printf (" %d: %lld", i, phase_hist[phase][i]);
+      printf ("\n");
+    }
+}
+
+/* Records that PHASE of a page fault took from START, a value
+   returned by timer_cycles(), until now. */
+void
+exception_time_phase (enum fault_phase phase, int64_t start)
+{
+  uint64_t cycles = timer_cycles () - start;
+  enum intr_level old_level;
+  int bucket = 0;
+
+  while (cycles > 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+
+  old_level = intr_disable ();
+  phase_hist[phase][bucket]++;
+  intr_set_level (old_level);
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -136,12 +175,14 @@ page_fault (struct intr_frame *f)
   bool write;         /* True: access was write, false: access was read. */
   bool user;          /* True: access by user, false: access by kernel. */
   void* fault_addr;   /* Fault address. */
-  int i;
   
   void* stack_pointer; /* Stack pointer */
   uint8_t* upage;
   struct page* page;
+  struct region* region;
   struct sup_table* sup;  /* Page table */
+  bool major = false;     /* True: had to wait for the disk */
+  int64_t start;
   
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -167,11 +208,12 @@ page_fault (struct intr_frame *f)
   
   sup = thread_current()->process->sup_table;
   
-  /* Get the stack pointer */
+  /* Get the stack pointer - in the kernel, the one the process made
+     its system call with */
   if (user)
     stack_pointer = f->esp;
   else
-    stack_pointer = thread_current()->stack;
+    stack_pointer = thread_current()->user_esp;
   
   /* Get page base of fault addr */
   upage = (uint8_t*)(lower_page_bound (fault_addr));
@@ -181,15 +223,26 @@ page_fault (struct intr_frame *f)
   /*  If address is in kernel space 
       or the stack pointer is in kernel space 
       or the stack has grown too large (and we aren't the kernel), kill f */
-  if (  user && (!is_user_vaddr(fault_addr) 
-    || (!is_user_vaddr(stack_pointer)) 
-    || (stack_pointer < MAX_STACK_ADDRESS))) 
+  if (!is_user_vaddr(fault_addr) 
+    || (user && ((!is_user_vaddr(stack_pointer)) 
+    || (stack_pointer < MAX_STACK_ADDRESS)))) 
   {
     page_fault_error(f, fault_addr, not_present, write, user);
+    return;
   }
   
-  /* Find page in page table */
+  /* Hold our page table lock for the whole fault, so that nobody can
+     evict our pages while we are bringing this one in. Other processes
+     keep faulting in parallel on their own locks. */
+  lock_acquire(&sup->lock);
+
+  /* Find page in page table - pages of our regions which have not
+     been touched yet get their entry now */
+  start = timer_cycles ();
   page = page_find (upage, sup);
+  if (page == NULL && (region = region_find (sup, upage)) != NULL)
+    page = page_create (region, upage);
+  exception_time_phase (FAULT_LOOKUP, start);
     
   /* If the page was found - check for read on write page-fault */
   if (page != NULL) 
@@ -198,7 +251,9 @@ page_fault (struct intr_frame *f)
     if ((write && !page->writable)) 
     {
       //printf("Page access was write and page is read-only\n");
+      lock_release(&sup->lock);
       page_fault_error(f, fault_addr, not_present, write, user);
+      return;
     }
   }
   
@@ -209,52 +264,85 @@ page_fault (struct intr_frame *f)
     {
     /* If the page hasn't been loaded - is executable/mmaped file - load_page from disk */
       if (!page->loaded)
-        load_page(page);
+        major = load_page(page);
         
       /* Otherwise page has been swapped out - load from swap */
       else 
+      {
         page_swap_in(page);
+        major = true;
+      }
       
+      /* Read ahead or drop behind, as the region's access hint says */
+      page_fault_ahead(upage);
     }
     
       
     else if ((int*)stack_pointer - (int*)fault_addr <= 32) 
     {
-      /* If the address will grow the stack beyond the max size, kill the process */
-      if (fault_addr < MAX_STACK_ADDRESS) {
+      region = region_find (sup, STACK_BASE);
+
+      /* If the address will grow the stack beyond the max size, or over
+         another region, kill the process */
+      if (fault_addr < MAX_STACK_ADDRESS || region == NULL
+          || upage >= region->start
+          || region_overlaps (sup, upage, region->start - upage)) {
         //printf("Stack has grown too large\n");
+        lock_release(&sup->lock);
         page_fault_error (f, fault_addr, not_present, write, user);
+        return;
       }
       
-      /* Grow stack */
-      page = page_allocate(upage, PAL_USER, true);
-      //printf("page addr = %p\tupage addr = %p\n",page,page->upage);
-      page->file = NULL;
-      for (i = 0; i < (PHYS_BASE - fault_addr) % PGSIZE; i++) {
-        page = page_find (upage + (i * PGSIZE), sup);
-        if (page == NULL) {
-          page = page_create (upage + (i * PGSIZE),true);
-          page->file = NULL;
-        }        
-      }
+      /* Grow stack - the pages in between are faulted in when used */
+      region->start = upage;
+      page = page_allocate(region, upage, PAL_ZERO);
     }
       
     /* Else trying to access memory process isn't supposed to, kill the process */
     else {
       //printf("Fell through all cases\n");
+      lock_release(&sup->lock);
       page_fault_error(f, fault_addr, not_present, write, user);
+      return;
     }
   }
+  
+  /* Write to a page shared copy-on-write since fork(), or to a clean
+     mmap page - make it writable. If it was evicted meanwhile the
+     retried write faults it back in instead. */
+  else if (page != NULL && (page->cow || page->clean_wp))
+  {
+    if (page->valid)
+      page_make_writable(page);
+  }
+
+  if (major)
+    sup->process->usage.major_faults++;
+  else
+    sup->process->usage.minor_faults++;
+  page_sample_working_set(sup);
+  lock_release(&sup->lock);
   //printf("f->esp = %p\n",f->esp);
   //intr_dump_frame (f);
   //debug_page_table(sup);
 
 }
 
+/* Kills the process for a page fault that can't be resolved - unless
+   the kernel was accessing user memory for it (userprog/uaccess.c), in
+   which case the access just fails. */
 static void
 page_fault_error (struct intr_frame *f, void* fault_addr, bool not_present, 
                       bool write, bool user)
 {
+  uint32_t fixup;
+
+  if (!user && (fixup = uaccess_fixup ((uint32_t)f->eip)) != 0)
+  {
+    f->eip = (void (*) (void))fixup;
+    return;
+  }
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
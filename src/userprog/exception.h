@@ -7,8 +7,22 @@
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 #define MAX_STACK_SIZE (1024*1024)  /* 1MB is the maxium stacksize */
 #define MAX_STACK_ADDRESS (PHYS_BASE - MAX_STACK_SIZE) /* Lowest point the stack can grow to */
+#define STACK_BASE (((uint8_t*) PHYS_BASE) - PGSIZE)   /* Top page of the stack */
+
+#include <stdint.h>
+
+/* Timed phases of a page fault. */
+enum fault_phase
+  {
+    FAULT_LOOKUP,       /* Finding the page's supplemental entry. */
+    FAULT_EVICT,        /* Evicting a frame to make room. */
+    FAULT_SWAP_IN,      /* Reading the page back from swap. */
+    FAULT_FILE_READ,    /* Reading the page from its file. */
+    FAULT_PHASE_CNT
+  };
 
 void exception_init (void);
 void exception_print_stats (void);
+void exception_time_phase (enum fault_phase, int64_t start);
 
 #endif /* userprog/exception.h */
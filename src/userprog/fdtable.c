@@ -0,0 +1,136 @@
+#include "userprog/fdtable.h"
+#include <bitmap.h>
+#include <debug.h>
+#include "threads/malloc.h"
+
+/* Slots in a table when it first needs some */
+#define FD_TABLE_MIN 16
+
+static bool grow (struct fd_table* t, size_t cnt);
+
+/* Initialises T as empty, handing out ids from FIRST up. Nothing is
+   allocated until the first object is added. */
+void
+fd_table_init (struct fd_table* t, int first)
+{
+  ASSERT (first >= 0);
+
+  t->slots = NULL;
+  t->used = NULL;
+  t->first = first;
+}
+
+/* Frees T's memory, but not the objects in it */
+void
+fd_table_destroy (struct fd_table* t)
+{
+  free (t->slots);
+  if (t->used != NULL)
+    bitmap_destroy (t->used);
+  t->slots = NULL;
+  t->used = NULL;
+}
+
+/* Adds P to T under the lowest free id, which it returns, or -1 if
+   out of memory */
+int
+fd_table_add (struct fd_table* t, void* p)
+{
+  size_t id = BITMAP_ERROR;
+
+  if (t->used != NULL)
+    id = bitmap_scan (t->used, 0, 1, false);
+  if (id == BITMAP_ERROR)
+    id = t->used != NULL ? bitmap_size (t->used) : (size_t) t->first;
+  return fd_table_put (t, id, p) ? (int) id : -1;
+}
+
+/* Adds P to T under ID, which must be free. Returns false if out of
+   memory */
+bool
+fd_table_put (struct fd_table* t, int id, void* p)
+{
+  ASSERT (id >= t->first);
+  ASSERT (p != NULL);
+
+  if (!grow (t, id + 1))
+    return false;
+  ASSERT (!bitmap_test (t->used, id));
+  bitmap_mark (t->used, id);
+  t->slots[id] = p;
+  return true;
+}
+
+/* Returns the object under ID in T, or NULL if there is none */
+void*
+fd_table_get (const struct fd_table* t, int id)
+{
+  if (id < t->first || t->used == NULL || (size_t) id >= bitmap_size (t->used))
+    return NULL;
+  return t->slots[id];
+}
+
+/* Frees ID in T, which must be in use */
+void
+fd_table_remove (struct fd_table* t, int id)
+{
+  ASSERT (fd_table_get (t, id) != NULL);
+
+  t->slots[id] = NULL;
+  bitmap_reset (t->used, id);
+}
+
+/* Returns the lowest id in use in T above ID, or -1 if there is none.
+   Start from -1 to visit them all. */
+int
+fd_table_next (const struct fd_table* t, int id)
+{
+  size_t next;
+
+  if (t->used == NULL)
+    return -1;
+  next = id + 1 < t->first ? t->first : id + 1;
+  if (next >= bitmap_size (t->used))
+    return -1;
+  next = bitmap_scan (t->used, next, 1, true);
+  return next == BITMAP_ERROR ? -1 : (int) next;
+}
+
+/* Makes room in T for at least CNT ids, doubling its size as needed.
+   The ids below T's first are marked used so that they are never
+   handed out. Returns false if out of memory, leaving T as it was */
+static bool
+grow (struct fd_table* t, size_t cnt)
+{
+  size_t old_cnt = t->used != NULL ? bitmap_size (t->used) : 0;
+  size_t new_cnt;
+  struct bitmap* used;
+  void** slots;
+  size_t i;
+
+  if (cnt <= old_cnt)
+    return true;
+  for (new_cnt = old_cnt != 0 ? old_cnt : FD_TABLE_MIN; new_cnt < cnt; )
+    new_cnt *= 2;
+
+  used = bitmap_create (new_cnt);
+  if (used == NULL)
+    return false;
+  slots = realloc (t->slots, new_cnt * sizeof *slots);
+  if (slots == NULL)
+  {
+    bitmap_destroy (used);
+    return false;
+  }
+
+  for (i = 0; i < new_cnt; i++)
+    if (i < old_cnt ? bitmap_test (t->used, i) : i < (size_t) t->first)
+      bitmap_mark (used, i);
+  for (i = old_cnt; i < new_cnt; i++)
+    slots[i] = NULL;
+  if (t->used != NULL)
+    bitmap_destroy (t->used);
+  t->used = used;
+  t->slots = slots;
+  return true;
+}
@@ -0,0 +1,24 @@
+#ifndef USERPROG_FDTABLE_H
+#define USERPROG_FDTABLE_H
+
+#include <stdbool.h>
+
+/* Table of a process's objects by small integer id - its open files
+   by descriptor, or its mappings. Looking up an id is an array index,
+   and a new object gets the lowest free id. */
+struct fd_table
+{
+  void** slots;           /* Objects by id, NULL if free */
+  struct bitmap* used;    /* Ids in use, the clear bits are the free ones */
+  int first;              /* Lowest id handed out - those below are reserved */
+};
+
+void fd_table_init (struct fd_table* t, int first);
+void fd_table_destroy (struct fd_table* t);
+int fd_table_add (struct fd_table* t, void* p);
+bool fd_table_put (struct fd_table* t, int id, void* p);
+void* fd_table_get (const struct fd_table* t, int id);
+void fd_table_remove (struct fd_table* t, int id);
+int fd_table_next (const struct fd_table* t, int id);
+
+#endif /* userprog/fdtable.h */
@@ -2,6 +2,7 @@
 #include "userprog/exception.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
 #include "threads/pte.h"
@@ -11,6 +12,11 @@
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
+
+/* TLB flush counts, for pagedir_print_stats() */
+static long long full_flush_cnt;    /* Whole TLB, by reloading CR3 */
+static long long page_flush_cnt;    /* Single entries, by INVLPG */
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -155,7 +161,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -183,11 +189,27 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Set the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else 
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_page (pd, vpage);
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
@@ -212,7 +234,7 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -262,29 +284,76 @@ invalidate_pagedir (uint32_t *pd)
       /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
       pagedir_activate (pd);
+      full_flush_cnt++;
     } 
 }
 
+/* Invalidates the TLB entry for virtual page VPAGE if PD is the
+   active page directory.  Inside a pagedir_batch_begin() /
+   pagedir_batch_end() pair for PD the invalidation is only queued.
+   See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+static void
+invalidate_page (uint32_t *pd, const void *vpage) 
+{
+  struct pagedir_batch *batch;
 
-/*Return true if pointer is 'safe'*/
-bool
-is_safe_ptr(const void* vaddr)
+  if (active_pd () != pd)
+    return;
+
+  batch = thread_current ()->tlb_batch;
+  if (batch != NULL && batch->pd == pd)
+    {
+      if (batch->cnt < PAGEDIR_BATCH_MAX)
+        batch->pages[batch->cnt] = vpage;
+      batch->cnt++;
+      return;
+    }
+
+  asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+  page_flush_cnt++;
+}
+
+/* Starts a batch of changes to the mappings of PD by the current
+   thread, e.g. unmapping a whole region.  TLB invalidations for PD
+   are deferred until pagedir_batch_end(), which issues them all at
+   once - or flushes the whole TLB if there were too many to be
+   worth invalidating one at a time. */
+void
+pagedir_batch_begin (struct pagedir_batch *batch, uint32_t *pd) 
 {
-  uint32_t *ptr;
-  
-  /*Check pointer not NULL and its not pointing to a kernel address*/
-  if(vaddr == NULL || !is_user_vaddr (vaddr))
-    return false;
-  
-  /* Check pointer points to mapped space */
-  ptr = lookup_sup_page (thread_current()->process, lower_page_bound(vaddr));
-  if (ptr == NULL)
-    //if ((vaddr < PHYS_BASE) && (vaddr > MAX_STACK_SIZE))
-      //return true;
-    //else
-      return false;
-  
- 
-  /*Otherwise the pointer is valid*/
-  return true;
+  struct thread *t = thread_current ();
+
+  ASSERT (t->tlb_batch == NULL);
+
+  batch->pd = pd;
+  batch->cnt = 0;
+  t->tlb_batch = batch;
+}
+
+/* Ends BATCH, performing the TLB invalidations it deferred. */
+void
+pagedir_batch_end (struct pagedir_batch *batch) 
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  ASSERT (t->tlb_batch == batch);
+  t->tlb_batch = NULL;
+
+  /* We may have been switched out and back in meanwhile, which
+     flushed the TLB anyway, but can't tell, so flush regardless */
+  if (batch->cnt > PAGEDIR_BATCH_MAX)
+    invalidate_pagedir (batch->pd);
+  else
+    for (i = 0; i < batch->cnt; i++)
+      invalidate_page (batch->pd, batch->pages[i]);
 }
+
+/* Prints TLB flush statistics. */
+void
+pagedir_print_stats (void) 
+{
+  printf ("TLB: %lld full flushes, %lld single-page flushes\n",
+          full_flush_cnt, page_flush_cnt);
+}
+
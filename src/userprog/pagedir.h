@@ -2,8 +2,21 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* Invalidations a batch remembers before it falls back to flushing
+   the whole TLB */
+#define PAGEDIR_BATCH_MAX 32
+
+/* Deferred TLB invalidations, see pagedir_batch_begin() */
+struct pagedir_batch
+  {
+    uint32_t *pd;                           /* Page directory being changed */
+    size_t cnt;                             /* Number of invalidations deferred */
+    const void *pages[PAGEDIR_BATCH_MAX];   /* The first PAGEDIR_BATCH_MAX of them */
+  };
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
@@ -11,10 +24,12 @@ void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
+void pagedir_set_writable (uint32_t *pd, const void *upage, bool writable);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
 void pagedir_activate (uint32_t *pd);
-
-bool is_safe_ptr (const void* vaddr);
+void pagedir_batch_begin (struct pagedir_batch *batch, uint32_t *pd);
+void pagedir_batch_end (struct pagedir_batch *batch);
+void pagedir_print_stats (void);
 
 #endif /* userprog/pagedir.h */
@@ -23,12 +23,63 @@
 #include "userprog/exception.h"
 #include "userprog/syscall.h"
 
-#define STACK_BASE (((uint8_t*) PHYS_BASE) - PGSIZE)
-
 
+/* If true, print each process's statistics when it exits.
+   Controlled by kernel command-line option "-vmstats". */
+bool process_vmstats;
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
 static bool load (char *command, void (**eip) (void), void **esp);
+static struct process* process_alloc (void);
+static bool process_copy_files (struct process* parent, struct process* child);
+static void process_print_usage (struct process* process);
+
+/* Passed from process_fork() to the new thread */
+struct fork_info
+{
+  struct process* parent;       /* Process being forked */
+  struct process* child;        /* Its new child */
+  struct intr_frame* if_;       /* Parent's user context, resumed in the child */
+};
+
+/* Allocates and initialises a process descriptor, with an empty
+   supplemental page table, as a child of the current thread. */
+static struct process*
+process_alloc (void)
+{
+  struct process* new_process = malloc(sizeof(struct process));
+
+  /* Initialise the new processes fields */
+  new_process->command = NULL;
+  new_process->load_success = false;
+  new_process->exit_status = EXIT_FAILURE;
+  sema_init(&new_process->load_complete, 0);
+  sema_init(&new_process->exit_complete, 0);
+  new_process->pid = PID_ERROR;
+  fd_table_init(&new_process->files, 2);
+  fd_table_init(&new_process->maps, 0);
+  new_process->process_file = NULL;
+  memset(&new_process->usage, 0, sizeof new_process->usage);
+  
+  /* Initialise the process' Supplemental page table*/
+  new_process->sup_table = malloc(sizeof(struct sup_table));
+  page_table_init(new_process->sup_table);
+  new_process->sup_table->process = new_process;
+
+  /* Children keep their parent's resident set limit */
+  if (thread_current()->process != NULL)
+  {
+    new_process->sup_table->rss_limit = thread_current()->process->sup_table->rss_limit;
+    new_process->sup_table->rss_auto = thread_current()->process->sup_table->rss_auto;
+  }
+
+
+  /* Push this new process into the current(parent) process list of children */
+  list_push_front(&thread_current()->children, &new_process->child_elem);
+
+  return new_process;
+}
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -43,7 +94,7 @@ process_execute (const char *command)
   char* save_ptr;
   char* file_name = malloc(PGSIZE);
 
-  new_process = malloc(sizeof(struct process));
+  new_process = process_alloc();
 
   /* Make a copy of FILE_NAME.
      Otherwise there's a race between the caller and load(). */
@@ -52,36 +103,10 @@ process_execute (const char *command)
     return TID_ERROR;
   strlcpy (new_process->command, command, PGSIZE);
 
-  /* Initialise the new processes fields */
-  new_process->load_success = false;
-  new_process->exit_status = EXIT_FAILURE;
-  sema_init(&new_process->load_complete, 0);
-  sema_init(&new_process->exit_complete, 0);
-  new_process->pid = PID_ERROR;
-  list_init(&new_process->open_files);
-  list_init(&new_process->mmaped_files);
-  new_process->next_fd = 2;
-  
-  /* Initialise the process' Supplemental page table*/
-  new_process->sup_table = malloc(sizeof(struct sup_table));
-  page_table_init(new_process->sup_table);
-  new_process->sup_table->process = new_process;
-
-
-  /* Push this new process into the current(parent) process list of children */
-  list_push_front(&thread_current()->children, &new_process->child_elem);
-  
   /* Returns just the filename of the command to execute */
   strlcpy(file_name, command, PGSIZE);
   strtok_r(file_name, " ", &save_ptr);
   
-  /*  If the thread's file name and the new threads file name is the same
-      copy the executable file's page structs - ensures sharing of 
-      data segments */
-  if (thread_current()->process != NULL && (thread_current()->name == file_name))
-    page_table_copy(thread_current()->process->sup_table, new_process->sup_table);
-
-  
   /* Create a new thread to execute FILE_NAME. */
   tid = thread_create (file_name, PRI_DEFAULT, start_process, new_process);
   if (tid == TID_ERROR) {
@@ -147,6 +172,147 @@ start_process (void *process_)
   NOT_REACHED ();
 }
 
+/* Clones the current process for the fork() system call. F is the
+   interrupt frame of the system call, which the child returns through
+   with 0 in eax.  Memory is shared copy-on-write, and open files and
+   mappings are shared by reference, each `struct file' with its
+   position; only the executable is reopened.  Returns the child's pid,
+   or PID_ERROR if it could not be created. */
+pid_t
+process_fork (struct intr_frame* f)
+{
+  struct thread* cur = thread_current();
+  struct fork_info info;
+  tid_t tid;
+
+  info.parent = cur->process;
+  info.child = process_alloc();
+  info.if_ = f;
+
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &info);
+  if (tid == TID_ERROR)
+  {
+    /* Nobody will ever exit as this child, so don't leave it to be
+       waited for */
+    list_remove(&info.child->child_elem);
+    free(info.child->sup_table);
+    free(info.child);
+    return PID_ERROR;
+  }
+
+  /* INFO lives on our stack, so wait until the child is done with it */
+  sema_down(&info.child->load_complete);
+
+  if(!info.child->load_success)
+    return PID_ERROR;
+
+  return tid;
+}
+
+/* Thread function for a forked child: copies the parent's address
+   space and files, then returns to user mode where the parent left. */
+static void
+start_fork (void* info_)
+{
+  struct fork_info* info = info_;
+  struct process* process = info->child;
+  struct thread* thread = thread_current();
+  struct intr_frame if_;
+  bool success = false;
+
+  thread->process = process;
+  memcpy (&if_, info->if_, sizeof if_);
+
+  /* fork() returns 0 in the child */
+  if_.eax = 0;
+
+  thread->pagedir = pagedir_create ();
+  if (thread->pagedir != NULL)
+  {
+    process_activate ();
+    success = process_copy_files (info->parent, process)
+              && page_table_fork (info->parent);
+  }
+
+  process->command = thread->name;
+  process->pid = thread->tid;
+  process->load_success = success;
+
+  /* Signal fork complete - the parent may run again */
+  sema_up(&process->load_complete);
+
+  if (!success)
+    thread_exit();
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives CHILD a reference to each file PARENT has open or mapped, so
+   that the two share its position, and its own `struct file' for the
+   executable, whose writes it denies in turn. */
+static bool
+process_copy_files (struct process* parent, struct process* child)
+{
+  struct file* file;
+  struct mmap_file* m;
+  struct mmap_file* m_copy;
+  bool success = true;
+  int id;
+
+  child->process_file = file_reopen(parent->process_file);
+  if (child->process_file == NULL)
+    success = false;
+  else
+    file_deny_write(child->process_file);
+
+  /* Descriptors and mapids stay the same in the child */
+  for (id = fd_table_next (&parent->files, -1);
+       success && id != -1; id = fd_table_next (&parent->files, id))
+  {
+    file = file_dup (fd_table_get (&parent->files, id));
+    if (!fd_table_put (&child->files, id, file))
+    {
+      file_close (file);
+      success = false;
+    }
+  }
+
+  for (id = fd_table_next (&parent->maps, -1);
+       success && id != -1; id = fd_table_next (&parent->maps, id))
+  {
+    m = fd_table_get (&parent->maps, id);
+    m_copy = malloc(sizeof(struct mmap_file));
+    if (m_copy == NULL)
+    {
+      success = false;
+      break;
+    }
+    memcpy (m_copy, m, sizeof *m);
+    m_copy->file = file_dup (m->file);
+    if (!fd_table_put (&child->maps, id, m_copy))
+    {
+      file_close (m_copy->file);
+      free(m_copy);
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+/* Returns the file of CHILD that stands in for PARENT's FILE after a
+   fork() - its executable or one of its mapped files, which the two
+   share. */
+struct file*
+process_fork_file (struct process* parent, struct process* child, 
+                   struct file* file)
+{
+  if (file == parent->process_file)
+    return child->process_file;
+  return file;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -188,42 +354,32 @@ process_exit (void)
   struct mmap_file* mmap_file;
   struct process* child;
   struct list_elem* e;
+  int id;
   
   printf ("%s: exit(%d)\n",cur->name, cur->process->exit_status);
   
-  lock_acquire(&filesys_lock);
-  
-  file_close(cur->process->process_file);
-  
   uint32_t *pd;
   
-  e = list_begin (&cur->process->open_files);
-  
   /* Closes this process's open files */
-  while ( e != list_end (&cur->process->open_files))
+  for (id = fd_table_next (&cur->process->files, -1); id != -1;
+       id = fd_table_next (&cur->process->files, id))
   {
-    file = list_entry(e, struct file, elem);
-    e = list_next (e);
-    if (!file->mmaped) {
-      file_close(file); }
-    else {
-      list_remove(&file->elem);
-      file->closed = true;
-    }
+    file = fd_table_get (&cur->process->files, id);
+    fd_table_remove (&cur->process->files, id);
+    file_close (file);
   }
-  lock_release(&filesys_lock);
+  fd_table_destroy (&cur->process->files);
+  dir_close(cur->cwd);
+  cur->cwd = NULL;
   
-  /* Frees all the memory used by the memory mapped files list */
-  e = list_begin (&cur->process->mmaped_files);
-  
-  while ( e != list_end (&cur->process->mmaped_files))
+  /* Unmaps the memory mapped files and frees the table */
+  for (id = fd_table_next (&cur->process->maps, -1); id != -1;
+       id = fd_table_next (&cur->process->maps, id))
   {
-    mmap_file = list_entry(e, struct mmap_file, elem);
-    e = list_next (e);
-    if (mmap_file != NULL) {
-      un_map_file(mmap_file, false);
-    }
+    mmap_file = fd_table_get (&cur->process->maps, id);
+    un_map_file(mmap_file, false);
   }
+  fd_table_destroy (&cur->process->maps);
   
   /* Wait for our children to die and free their memory - process_wait frees 
      the memory for the children's process structs */
@@ -235,8 +391,15 @@ process_exit (void)
     process_wait(child->pid);
   }
   
+  if (process_vmstats)
+    process_print_usage(cur->process);
+
   /* Frees all the memory used by the hash table */
   page_table_destroy(cur->process->sup_table);
+  
+  /* Only close the executable once none of our pages can refer to it -
+     its inode is the page cache key of our shared text frames */
+  file_close(cur->process->process_file);
 
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
@@ -259,6 +422,32 @@ process_exit (void)
   
 }
 
+/* Fills in USAGE with PROCESS's statistics. The counts of pages in
+   memory and in swap are taken from its page table. */
+void
+process_get_usage (struct process* process, struct rusage* usage)
+{
+  struct sup_table* sup = process->sup_table;
+
+  lock_acquire(&sup->lock);
+  *usage = process->usage;
+  page_table_count(sup, &usage->resident, &usage->swapped);
+  lock_release(&sup->lock);
+}
+
+static void
+process_print_usage (struct process* process)
+{
+  struct rusage usage;
+
+  process_get_usage(process, &usage);
+  printf ("%s: %u resident, %u swapped, %u major faults, %u minor faults, "
+          "%u evictions, %u swap-ins, %u write-backs\n",
+          thread_current()->name, usage.resident, usage.swapped,
+          usage.major_faults, usage.minor_faults, usage.evictions,
+          usage.swap_ins, usage.write_backs);
+}
+
 /* Sets up the CPU for running user code in the current
    thread.
    This function is called on every context switch. */
@@ -356,15 +545,17 @@ load (char* command, void (**eip) (void), void **esp)
   bool success = false;
   int i;
 
+  /* Our page table lock is always taken before the file system's
+     inode, directory and journal locks */
+  lock_acquire(&t->process->sup_table->lock);
+
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
 
-  /* Open executable file and deny write access. This lock is held open for some time. */
-  lock_acquire(&filesys_lock);
-  
+  /* Open executable file and deny write access. */
   file = filesys_open(t->name);
 
   if (file == NULL) 
@@ -378,80 +569,77 @@ load (char* command, void (**eip) (void), void **esp)
   file_deny_write(file);
   
   //debug_page_table(t->process->sup_table);
-  if (page_table_empty(t->process->sup_table))
-  {
-    /* Read and verify executable header. */
-    if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
-        || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
-        || ehdr.e_type != 2
-        || ehdr.e_machine != 3
-        || ehdr.e_version != 1
-        || ehdr.e_phentsize != sizeof (struct Elf32_Phdr)
-        || ehdr.e_phnum > 1024) 
-      {
-        printf ("load: %s: error loading executable\n", t->name);
-        goto done; 
-      }
-      
-    /* Read program headers. */
-    file_ofs = ehdr.e_phoff;
-    for (i = 0; i < ehdr.e_phnum; i++) 
-      {
-        struct Elf32_Phdr phdr;
-
-        if (file_ofs < 0 || file_ofs > file_length (file))
-          goto done;
-        file_seek (file, file_ofs);
-
-        if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
+  /* Read and verify executable header. */
+  if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
+      || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
+      || ehdr.e_type != 2
+      || ehdr.e_machine != 3
+      || ehdr.e_version != 1
+      || ehdr.e_phentsize != sizeof (struct Elf32_Phdr)
+      || ehdr.e_phnum > 1024) 
+    {
+      printf ("load: %s: error loading executable\n", t->name);
+      goto done; 
+    }
+    
+  /* Read program headers. */
+  file_ofs = ehdr.e_phoff;
+  for (i = 0; i < ehdr.e_phnum; i++) 
+    {
+      struct Elf32_Phdr phdr;
+
+      if (file_ofs < 0 || file_ofs > file_length (file))
+        goto done;
+      file_seek (file, file_ofs);
+
+      if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
+        goto done;
+      file_ofs += sizeof phdr;
+      switch (phdr.p_type) 
+        {
+        case PT_NULL:
+        case PT_NOTE:
+        case PT_PHDR:
+        case PT_STACK:
+        default:
+          /* Ignore this segment. */
+          break;
+        case PT_DYNAMIC:
+        case PT_INTERP:
+        case PT_SHLIB:
           goto done;
-        file_ofs += sizeof phdr;
-        switch (phdr.p_type) 
-          {
-          case PT_NULL:
-          case PT_NOTE:
-          case PT_PHDR:
-          case PT_STACK:
-          default:
-            /* Ignore this segment. */
-            break;
-          case PT_DYNAMIC:
-          case PT_INTERP:
-          case PT_SHLIB:
+        case PT_LOAD:
+          if (validate_segment (&phdr, file)) 
+            {
+              bool writable = (phdr.p_flags & PF_W_P) != 0;
+              uint32_t file_page = phdr.p_offset & ~PGMASK;
+              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+              uint32_t page_offset = phdr.p_vaddr & PGMASK;
+              uint32_t read_bytes, zero_bytes;
+              if (phdr.p_filesz > 0)
+                {
+                  /* Normal segment.
+                    Read initial part from disk and zero the rest. */
+                  read_bytes = page_offset + phdr.p_filesz;
+                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
+                                - read_bytes);
+                }
+              else 
+                {
+                  /* Entirely zero.
+                    Don't read anything from disk. */
+                  read_bytes = 0;
+                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                }
+              if (!load_segment (file, file_page, (void *) mem_page,
+                                read_bytes, zero_bytes, writable))
+                goto done;
+            }
+          else
             goto done;
-          case PT_LOAD:
-            if (validate_segment (&phdr, file)) 
-              {
-                bool writable = (phdr.p_flags & PF_W_P) != 0;
-                uint32_t file_page = phdr.p_offset & ~PGMASK;
-                uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
-                uint32_t page_offset = phdr.p_vaddr & PGMASK;
-                uint32_t read_bytes, zero_bytes;
-                if (phdr.p_filesz > 0)
-                  {
-                    /* Normal segment.
-                      Read initial part from disk and zero the rest. */
-                    read_bytes = page_offset + phdr.p_filesz;
-                    zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                  - read_bytes);
-                  }
-                else 
-                  {
-                    /* Entirely zero.
-                      Don't read anything from disk. */
-                    read_bytes = 0;
-                    zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
-                  }
-                if (!load_segment (file, file_page, (void *) mem_page,
-                                  read_bytes, zero_bytes, writable))
-                  goto done;
-              }
-            else
-              goto done;
-            break;
-          }
-      }
-  }
+          break;
+        }
+    }
   
     
   /* Set up stack. */
@@ -468,8 +656,8 @@ load (char* command, void (**eip) (void), void **esp)
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. Unlock file system. */
-  lock_release(&filesys_lock);
+  /* We arrive here whether the load is successful or not. */
+  lock_release(&t->process->sup_table->lock);
   return success;
 }
 
@@ -524,9 +712,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
 
 /* Changed this to lazily load the process executable */
 /* Conceptually loads a segment starting at offset OFS in FILE at address
-   UPAGE by adding in total (READ_BYTES + ZERO_BYTES)/PGSIZE pages of virtual
-   memory to the processes sup_table.
-   Saving READ_BYTES, ZERO_BYTES, OFS, WRITABLE, to each page.*/
+   UPAGE by adding a region of (READ_BYTES + ZERO_BYTES)/PGSIZE pages of
+   virtual memory to the processes sup_table. Pages are only created
+   when they are first faulted in.
+   Returns false if the segment overlaps memory that is already mapped. */
 bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
@@ -535,34 +724,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  struct page* page;
-  off_t old_pos = file->pos;
-  
-  while (read_bytes > 0 || zero_bytes > 0) 
-    {
-      /* Calculate how to fill this page.
-      We will read PAGE_READ_BYTES bytes from FILE
-      and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-      
-      page = page_create(upage, writable);
-      page->ofs = ofs;
-      page->read_bytes = page_read_bytes;
-      page->zero_bytes = page_zero_bytes;
-      page->file = file;
-
-      /* Advance. */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      upage += PGSIZE;
-      ofs += PGSIZE;
-    }
-    
-    /* Retain the file's old position offset */
-    file_seek(file, old_pos);
-
-  return true;
+  return region_add (thread_current()->process->sup_table, upage,
+                     read_bytes + zero_bytes, file, ofs, read_bytes,
+                     writable) != NULL;
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -578,11 +742,16 @@ setup_stack (void **esp, char *command)
   int pointer_size = sizeof(void*);
   int num_args = 0;
   struct page* page;
+  struct region* stack;
 
   list_init(&arguments);
   
-  page = page_allocate(STACK_BASE, PAL_ZERO, true);
-  page->read_bytes = PGSIZE;
+  /* The stack region starts as one page and grows down on faults */
+  stack = region_add(thread_current()->process->sup_table, STACK_BASE,
+                     PGSIZE, NULL, 0, 0, true);
+  if (stack == NULL)
+    return false;
+  page = page_allocate(stack, STACK_BASE, PAL_ZERO);
 
   ptr = PHYS_BASE;
 
@@ -649,11 +818,6 @@ setup_stack (void **esp, char *command)
 
   *esp = ptr;
 
-  /*  Adds a page for the the very bottom of the stack - 
-      ensures the stack can grow to max size and we don't enter the stack
-      when doing memory mapping */
-  page_create(MAX_STACK_ADDRESS, true);
-
   return true;
 }
 
@@ -5,6 +5,7 @@
 #include "threads/synch.h"
 #include "vm/page.h"
 #include "filesys/off_t.h"
+#include "userprog/fdtable.h"
 
 #define EXIT_SUCCESS 0
 #define EXIT_FAILURE -1
@@ -13,7 +14,7 @@ tid_t process_execute (const char *command);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
-void load_page(struct page* p);
+bool load_page(struct page* p);
 bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable);
 
@@ -29,6 +30,25 @@ typedef int mapid_t;
 
 #define PID_ERROR ((pid_t) -1)
 
+/* Memory and fault statistics - same as in lib/user/syscall.h */
+struct rusage
+{
+  unsigned resident;      /* Pages in memory */
+  unsigned swapped;       /* Pages in swap */
+  unsigned major_faults;  /* Faults that had to read the disk */
+  unsigned minor_faults;  /* Faults served from memory */
+  unsigned evictions;     /* Pages taken away by eviction */
+  unsigned swap_ins;      /* Pages read back from swap */
+  unsigned write_backs;   /* Mapped pages written back to their files */
+};
+
+/* If true, print each process's statistics when it exits.
+   Controlled by kernel command-line option "-vmstats". */
+extern bool process_vmstats;
+
+struct intr_frame;
+pid_t process_fork (struct intr_frame* f);
+
 struct arg_elem
 {
   char* argument;         /* Argument */
@@ -43,7 +63,6 @@ struct mmap_file
   struct file* file;      /* Pointer to the file being mapped */
   void* addr;             /* Start address of the mapped file */
   size_t file_size;       /* Size of the file - use to work out the end of the file in memory */
-  struct list_elem elem;  /* list_elem */  
 };
 
 struct process
@@ -55,12 +74,16 @@ struct process
   struct semaphore exit_complete;   /* Used in process_wait() */
   pid_t pid;                        /* Process pid */
   struct list_elem child_elem;      /* So it can be made a child of another processes thread*/
-  struct list open_files;           /* List of files the process has open */
-  struct list mmaped_files;         /* List of memory mapped files */
-  int next_fd;                      /* Used for generating file descriptors*/
+  struct fd_table files;            /* Open files by descriptor, from 2 */
+  struct fd_table maps;             /* Memory mapped files by mapid */
   struct file* process_file;        /* The current process's executable */
   struct sup_table* sup_table;      /* Hash table of pages */
+  struct rusage usage;              /* Counts of faults etc - guarded by the sup_table lock */
 };
 
+struct file* process_fork_file (struct process* parent, struct process* child,
+                                struct file* file);
+void process_get_usage (struct process* process, struct rusage* usage);
+
 
 #endif /* userprog/process.h */
@@ -9,12 +9,16 @@
 #include "userprog/pagedir.h"
 #include "threads/malloc.h"
 #include "filesys/file.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
 #include "devices/input.h"
 #include <string.h>
 #include "userprog/exception.h"
+#include "userprog/uaccess.h"
+#include <round.h>
 
 #define MAXCHAR 512
 
@@ -30,14 +34,26 @@ static void syscall_open    (uint32_t* eax, const char* file_name);
 static void syscall_filesize(uint32_t* eax, int fd);
 static void syscall_read    (uint32_t* eax, int fd, void* buffer, unsigned int size);
 static void syscall_write   (uint32_t* eax, int fd, const void* buffer, unsigned size);
+static void syscall_pread   (uint32_t* eax, int fd, void* buffer, unsigned size, off_t offset);
+static void syscall_pwrite  (uint32_t* eax, int fd, const void* buffer, unsigned size, off_t offset);
 static void syscall_seek    (int fd, unsigned int position);
 static void syscall_tell    (uint32_t* eax, int fd);
 static void syscall_close   (int fd);
 static void syscall_mmap    (uint32_t* eax, int fd, const void* addr);
 static void syscall_munmap  (mapid_t mapid);
-
-static void check_safe_ptr (const void* ptr, int no_args);
-static void check_buffer_safety (const void* buffer, int size, bool write);
+static void syscall_fork    (uint32_t* eax, struct intr_frame* f);
+static void syscall_madvise (uint32_t* eax, void* addr, size_t length, int advice);
+static void syscall_msync   (uint32_t* eax, mapid_t mapid);
+static void syscall_getrusage (uint32_t* eax, struct rusage* usage);
+static void syscall_setrss  (uint32_t* eax, int pages);
+static void syscall_chdir   (uint32_t* eax, const char* dir);
+static void syscall_mkdir   (uint32_t* eax, const char* dir);
+static void syscall_readdir (uint32_t* eax, int fd, char* name);
+static void syscall_isdir   (uint32_t* eax, int fd);
+static void syscall_inumber (uint32_t* eax, int fd);
+
+static void copy_args (const void* esp, uint32_t* args, int no_args);
+static char* copy_string (const char* ustr);
 static bool check_pages (const void* addr, int size, struct sup_table* sup);
 
 
@@ -63,95 +79,149 @@ syscall_handler (struct intr_frame *f)
 {
   
   void* esp = f->esp;
-  thread_current()->stack = (uint8_t*)esp;
+  thread_current()->user_esp = esp;
   uint32_t* eax = &f->eax;
-  unsigned int call_number = 0xDEADBEEF;
+  uint32_t args[5];     /* Call number, then its arguments */
   
-  check_safe_ptr(esp, 1);
-  call_number = *(uint32_t*)esp;
-
-  void* argument_1 = esp + 1 * sizeof(uint32_t);
-  void* argument_2 = esp + 2 * sizeof(uint32_t);
-  void* argument_3 = esp + 3 * sizeof(uint32_t);
+  copy_args(esp, args, 0);
 
-  switch(call_number)
+  switch(args[0])
   {
     case SYS_HALT: 
       syscall_halt(); 
       break;
       
     case SYS_EXIT:
-      check_safe_ptr (argument_1, 1);
-      syscall_exit(*(int*)argument_1); 
+      copy_args (esp, args, 1);
+      syscall_exit((int)args[1]); 
       break;
       
     case SYS_EXEC:
-      check_safe_ptr (argument_1, 1);
-      syscall_exec(eax, *(const char**)argument_1); 
+      copy_args (esp, args, 1);
+      syscall_exec(eax, (const char*)args[1]); 
       break;
       
     case SYS_WAIT:
-      check_safe_ptr (argument_1, 1);
-      syscall_wait(eax, *((pid_t*)argument_1)); 
+      copy_args (esp, args, 1);
+      syscall_wait(eax, (pid_t)args[1]); 
       break;
       
     case SYS_CREATE:
-      check_safe_ptr (argument_1, 2);
-      syscall_create(eax, *(const char**)argument_1, *(unsigned int*)argument_2); 
+      copy_args (esp, args, 2);
+      syscall_create(eax, (const char*)args[1], (unsigned int)args[2]); 
       break;
       
     case SYS_REMOVE: 
-      check_safe_ptr (argument_1, 1);
-      syscall_remove(eax, *(const char**)argument_1); 
+      copy_args (esp, args, 1);
+      syscall_remove(eax, (const char*)args[1]); 
       break;
       
     case SYS_OPEN:
-      check_safe_ptr (argument_1, 1);
-      syscall_open(eax, *(const char**)argument_1); 
+      copy_args (esp, args, 1);
+      syscall_open(eax, (const char*)args[1]); 
       break;
       
     case SYS_FILESIZE:
-      check_safe_ptr (argument_1, 1);
-      syscall_filesize(eax, *(int*)argument_1); 
+      copy_args (esp, args, 1);
+      syscall_filesize(eax, (int)args[1]); 
       break;
       
     case SYS_READ:
-      check_safe_ptr (argument_1, 3);
-      syscall_read(eax, *(int*)argument_1, *(void**)argument_2, *((unsigned int*)argument_3)); 
+      copy_args (esp, args, 3);
+      syscall_read(eax, (int)args[1], (void*)args[2], (unsigned int)args[3]); 
       break;
       
     case SYS_WRITE: 
-      check_safe_ptr (argument_1, 3);
-      syscall_write(eax, *(int*)argument_1, *(void**)argument_2, *((unsigned int*)argument_3)); 
+      copy_args (esp, args, 3);
+      syscall_write(eax, (int)args[1], (const void*)args[2], (unsigned int)args[3]); 
+      break;
+      
+    case SYS_PREAD:
+      copy_args (esp, args, 4);
+      syscall_pread(eax, (int)args[1], (void*)args[2], (unsigned int)args[3], (off_t)args[4]);
+      break;
+      
+    case SYS_PWRITE:
+      copy_args (esp, args, 4);
+      syscall_pwrite(eax, (int)args[1], (const void*)args[2], (unsigned int)args[3], (off_t)args[4]);
       break;
       
     case SYS_SEEK: 
-      check_safe_ptr (argument_1, 2);
-      syscall_seek(*(int*)argument_1, *(unsigned int*)argument_2); 
+      copy_args (esp, args, 2);
+      syscall_seek((int)args[1], (unsigned int)args[2]); 
       break;
       
     case SYS_TELL:
-      check_safe_ptr (argument_1, 1);
-      syscall_tell(eax, *(int*)argument_1); 
+      copy_args (esp, args, 1);
+      syscall_tell(eax, (int)args[1]); 
       break;
       
     case SYS_CLOSE: 
-      check_safe_ptr (argument_1, 1);
-      syscall_close(*(int*)argument_1); 
+      copy_args (esp, args, 1);
+      syscall_close((int)args[1]); 
       break;
       
     case SYS_MMAP:
-      check_safe_ptr (argument_1, 2);
-      syscall_mmap(eax, *(int*)argument_1, *(void**)argument_2);
+      copy_args (esp, args, 2);
+      syscall_mmap(eax, (int)args[1], (const void*)args[2]);
       break;
       
     case SYS_MUNMAP:
-      check_safe_ptr (argument_1, 1);
-      syscall_munmap((*(mapid_t*)argument_1));
+      copy_args (esp, args, 1);
+      syscall_munmap((mapid_t)args[1]);
+      break;
+      
+    case SYS_FORK:
+      syscall_fork(eax, f);
+      break;
+      
+    case SYS_MADVISE:
+      copy_args (esp, args, 3);
+      syscall_madvise(eax, (void*)args[1], (size_t)args[2], (int)args[3]);
+      break;
+      
+    case SYS_MSYNC:
+      copy_args (esp, args, 1);
+      syscall_msync(eax, (mapid_t)args[1]);
+      break;
+      
+    case SYS_GETRUSAGE:
+      copy_args (esp, args, 1);
+      syscall_getrusage(eax, (struct rusage*)args[1]);
+      break;
+      
+    case SYS_SETRSS:
+      copy_args (esp, args, 1);
+      syscall_setrss(eax, (int)args[1]);
+      break;
+      
+    case SYS_CHDIR:
+      copy_args (esp, args, 1);
+      syscall_chdir(eax, (const char*)args[1]);
+      break;
+      
+    case SYS_MKDIR:
+      copy_args (esp, args, 1);
+      syscall_mkdir(eax, (const char*)args[1]);
+      break;
+      
+    case SYS_READDIR:
+      copy_args (esp, args, 2);
+      syscall_readdir(eax, (int)args[1], (char*)args[2]);
+      break;
+      
+    case SYS_ISDIR:
+      copy_args (esp, args, 1);
+      syscall_isdir(eax, (int)args[1]);
+      break;
+      
+    case SYS_INUMBER:
+      copy_args (esp, args, 1);
+      syscall_inumber(eax, (int)args[1]);
       break;
       
     default: 
-      printf("Invalid syscall: %d\n", call_number);
+      printf("Invalid syscall: %d\n", args[0]);
   }
 }
 
@@ -173,12 +243,34 @@ syscall_exit(int status)
   NOT_REACHED ();
 }
 
+/* The child resumes from F too, with eax cleared by process_fork() */
+static void
+syscall_fork(uint32_t* eax, struct intr_frame* f)
+{
+  syscall_return_pid_t (eax, process_fork(f));
+}
+
+/* Returns 0 on success, -1 if the hint could not be applied */
+static void
+syscall_madvise(uint32_t* eax, void* addr, size_t length, int advice)
+{
+  if (!is_user_vaddr(addr) || !page_advise(addr, length, advice))
+    syscall_return_int (eax, -1);
+  else
+    syscall_return_int (eax, 0);
+}
+
 static void 
 syscall_exec(uint32_t* eax, const char *command)
 {
-  if (!is_safe_ptr(command)) 
-    thread_exit();
-  syscall_return_int (eax, process_execute(command));
+  char* kcommand = copy_string(command);
+  if (kcommand == NULL)
+  {
+    syscall_return_int (eax, -1);
+    return;
+  }
+  syscall_return_int (eax, process_execute(kcommand));
+  palloc_free_page(kcommand);
 }
 
 static void 
@@ -187,32 +279,38 @@ syscall_wait(uint32_t* eax, pid_t pid)
   syscall_return_pid_t (eax, process_wait(pid));
 }
 
-/* Lock filesystem, create file, unlock, return bool for success*/
+/* Create file, return bool for success*/
 static void 
 syscall_create(uint32_t* eax, const char *filename, unsigned int initial_size)
 {
   bool success = false;
-  if (!is_safe_ptr(filename)) 
-    thread_exit();
+  char* name = copy_string(filename);
+  if (name == NULL)
+  {
+    syscall_return_bool (eax, false);
+    return;
+  }
 
-  lock_acquire(&filesys_lock);
-  success = filesys_create(filename, initial_size);
-  lock_release(&filesys_lock);
+  success = filesys_create(name, initial_size);
+  palloc_free_page(name);
   
   syscall_return_bool (eax, success);
 }
 
-/* Lock filesystem, remove file, unlock */
+/* Remove file, return bool for success */
 static void 
 syscall_remove(uint32_t* eax, const char *file)
 {
   bool success = false;
-  if (!is_safe_ptr(file)) 
-    thread_exit();
+  char* name = copy_string(file);
+  if (name == NULL)
+  {
+    syscall_return_bool (eax, false);
+    return;
+  }
   
-  lock_acquire(&filesys_lock);
-  success = filesys_remove(file);
-  lock_release(&filesys_lock);
+  success = filesys_remove(name);
+  palloc_free_page(name);
   
   syscall_return_bool (eax, success);
 }
@@ -222,25 +320,28 @@ static void
 syscall_open(uint32_t* eax, const char *file_name)
 {
   struct file* file;
-  if (!is_safe_ptr(file_name)) 
-    thread_exit();
+  char* name = copy_string(file_name);
+  if (name == NULL)
+  {
+    syscall_return_int (eax, -1);
+    return;
+  }
   
   struct thread* t = thread_current();
-  int fd = t->process->next_fd++;
+  int fd;
 
-  /* Lock filesystem, open file, unlock */
-  lock_acquire(&filesys_lock);
-  file = filesys_open(file_name);
-  lock_release(&filesys_lock);
+  file = filesys_open(name);
+  palloc_free_page(name);
 
   /* If file not found, set eax to -1*/
   if (file == NULL) 
     syscall_return_int(eax, -1);
   else {
-    /* Adds file to process' open_files list and returns fd */
-      file->fd = fd;
-      list_push_back(&t->process->open_files, &file->elem);
-      syscall_return_int (eax, fd);
+    /* Gives file the lowest free fd and returns it */
+    fd = fd_table_add (&t->process->files, file);
+    if (fd == -1)
+      file_close (file);
+    syscall_return_int (eax, fd);
   }
 }
 
@@ -258,91 +359,217 @@ syscall_filesize(uint32_t* eax, int fd)
 
   else 
   {
-    lock_acquire(&filesys_lock);
     size = (int) file_length(file);
-    lock_release(&filesys_lock);
     syscall_return_int (eax, size);
   }
 }
 
+/* File and console data goes through a kernel page, so that the user
+   buffer is never touched while holding a file system lock */
 static void 
 syscall_read(uint32_t* eax, int fd, void* buffer, unsigned int size)
 {
+  struct file* file = NULL;
+  uint8_t* kbuf;
+  unsigned int read_size = 0;
+  unsigned int chunk;
+  unsigned int n;
+
+  /* Unmapped pages are caught by copy_to_user() */
+  if (!is_user_range(buffer, size))
+    thread_exit();
 
-  check_buffer_safety(buffer, size, true);
-  
-  load_buffer_pages(buffer, size);
-  
-  struct file* file;
-  int read_size = 0;
-  
-  /* If fd is 0, read from console */
-  if (fd == 0) {
+  /* If fd is incorrect or a directory, return -1 */
+  if (fd != 0 && ((file = find_file (fd)) == NULL
+                  || inode_is_dir (file_get_inode (file))))
+  {
+    syscall_return_int(eax, -1);
+    return;
+  }
 
-    while ((unsigned int)read_size < size) {
-      *(char*)buffer = input_getc();
-      read_size++;
-      buffer += sizeof(uint8_t);
-    }
+  kbuf = palloc_get_page(0);
+  if (kbuf == NULL)
+  {
+    syscall_return_int(eax, -1);
+    return;
   }
-  /* Otherwise, read from file */
-  else
+  
+  while (read_size < size)
   {
-    file = find_file ( fd );
-    
-    /* If fd is incorrect, return -1 */
-    if (file == NULL)
-      syscall_return_int(eax, -1);
-    /* Lock filesystem, read file, unlock */
-    else 
+    chunk = size - read_size < PGSIZE ? size - read_size : PGSIZE;
+
+    /* If fd is 0, read from console */
+    if (fd == 0)
+    {
+      for (n = 0; n < chunk; n++)
+        kbuf[n] = input_getc();
+    }
+    /* Otherwise read the file */
+    else
     {
-      lock_acquire(&filesys_lock);
-      read_size = (int) file_read(file, buffer, size);
-      lock_release(&filesys_lock);    
-      syscall_return_int (eax, read_size);
+      n = (unsigned int) file_read(file, kbuf, chunk);
+    }
+
+    if (!copy_to_user((uint8_t*)buffer + read_size, kbuf, n))
+    {
+      palloc_free_page(kbuf);
+      thread_exit();
     }
+    read_size += n;
+    if (n < chunk)
+      break;
   }
+
+  palloc_free_page(kbuf);
+  syscall_return_int (eax, read_size);
 }
 
 static void
 syscall_write(uint32_t* eax, int fd, const void *buffer, unsigned int size)
 {
-  check_buffer_safety(buffer, size, false);
+  struct file* file = NULL;
+  uint8_t* kbuf;
+  unsigned int write_size = 0;
+  unsigned int chunk;
+  unsigned int n;
+
+  /* Unmapped pages are caught by copy_from_user() */
+  if (!is_user_range(buffer, size))
+    thread_exit();
   
-  int write_size;
+  /* If fd is incorrect or a directory, return -1 */
+  if (fd != 1 && ((file = find_file (fd)) == NULL
+                  || inode_is_dir (file_get_inode (file))))
+  {
+    syscall_return_int(eax, -1);
+    return;
+  }
+
+  kbuf = palloc_get_page(0);
+  if (kbuf == NULL)
+  {
+    syscall_return_int(eax, -1);
+    return;
+  }
+
+  while (write_size < size)
+  {
+    chunk = size - write_size < PGSIZE ? size - write_size : PGSIZE;
+    if (!copy_from_user(kbuf, (const uint8_t*)buffer + write_size, chunk))
+    {
+      palloc_free_page(kbuf);
+      thread_exit();
+    }
+
+    /* Writes to console, in blocks < maxchar */
+    if (fd == 1)
+    {
+      for (n = 0; n < chunk; n += MAXCHAR)
+        putbuf((char*)kbuf + n, chunk - n < MAXCHAR ? chunk - n : MAXCHAR);
+      n = chunk;
+    }
+    /* Otherwise write to the file */
+    else
+    {
+      n = (unsigned int) file_write(file, kbuf, chunk);
+    }
+
+    write_size += n;
+    if (n < chunk)
+      break;
+  }
+
+  palloc_free_page(kbuf);
+  syscall_return_int(eax, write_size);
+}
+
+/* Like syscall_read from a file, but at OFFSET rather than the file's
+   position, which is left alone - so threads sharing a descriptor
+   don't race on it. Returns -1 for a negative OFFSET */
+static void
+syscall_pread(uint32_t* eax, int fd, void* buffer, unsigned int size, off_t offset)
+{
   struct file* file;
-  
-  /* Writes to console, in blocks < maxchar */
-  if (fd == 1) {
-    for (write_size = size; write_size > 0; write_size -= MAXCHAR) {
-      if (write_size < MAXCHAR)
-        putbuf((char*)buffer, write_size);
-
-      else {
-        putbuf((char*)buffer, MAXCHAR);
-        buffer += MAXCHAR;
-      }
-      syscall_return_int (eax, size);
+  uint8_t* kbuf;
+  unsigned int read_size = 0;
+  unsigned int chunk;
+  unsigned int n;
+
+  if (!is_user_range(buffer, size))
+    thread_exit();
+
+  if (offset < 0 || (file = find_file (fd)) == NULL
+      || inode_is_dir (file_get_inode (file))
+      || (kbuf = palloc_get_page(0)) == NULL)
+  {
+    syscall_return_int(eax, -1);
+    return;
+  }
+
+  /* Offsets stay within off_t */
+  if (size > (unsigned int)(INT32_MAX - offset))
+    size = INT32_MAX - offset;
+
+  while (read_size < size)
+  {
+    chunk = size - read_size < PGSIZE ? size - read_size : PGSIZE;
+    n = (unsigned int) file_read_at(file, kbuf, chunk, offset + read_size);
+    if (!copy_to_user((uint8_t*)buffer + read_size, kbuf, n))
+    {
+      palloc_free_page(kbuf);
+      thread_exit();
     }
+    read_size += n;
+    if (n < chunk)
+      break;
   }
-  /* Write to file fd.*/
-  else {
-    file = find_file(fd);
-    
-    /* If fd is incorrect, return -1 */
-    if (file == NULL)
-      syscall_return_int(eax, -1);
-    
-    else {
-      
-      /* Lock filesystem, write to file, unlock */
-      lock_acquire(&filesys_lock);
-      write_size = (int)file_write(file, buffer, size);
-      lock_release(&filesys_lock);
-      
-      syscall_return_int(eax, write_size);
+
+  palloc_free_page(kbuf);
+  syscall_return_int (eax, read_size);
+}
+
+/* Like syscall_write to a file, but at OFFSET rather than the file's
+   position, which is left alone. Returns -1 for a negative OFFSET */
+static void
+syscall_pwrite(uint32_t* eax, int fd, const void *buffer, unsigned int size, off_t offset)
+{
+  struct file* file;
+  uint8_t* kbuf;
+  unsigned int write_size = 0;
+  unsigned int chunk;
+  unsigned int n;
+
+  if (!is_user_range(buffer, size))
+    thread_exit();
+
+  if (offset < 0 || (file = find_file (fd)) == NULL
+      || inode_is_dir (file_get_inode (file))
+      || (kbuf = palloc_get_page(0)) == NULL)
+  {
+    syscall_return_int(eax, -1);
+    return;
+  }
+
+  /* Offsets stay within off_t */
+  if (size > (unsigned int)(INT32_MAX - offset))
+    size = INT32_MAX - offset;
+
+  while (write_size < size)
+  {
+    chunk = size - write_size < PGSIZE ? size - write_size : PGSIZE;
+    if (!copy_from_user(kbuf, (const uint8_t*)buffer + write_size, chunk))
+    {
+      palloc_free_page(kbuf);
+      thread_exit();
     }
+    n = (unsigned int) file_write_at(file, kbuf, chunk, offset + write_size);
+    write_size += n;
+    if (n < chunk)
+      break;
   }
+
+  palloc_free_page(kbuf);
+  syscall_return_int(eax, write_size);
 }
 
 static void 
@@ -358,10 +585,7 @@ syscall_seek (int fd, unsigned position)
 
   else
   {
-    /* Lock filesystem, seek to position in file, unlock */
-    lock_acquire(&filesys_lock);
     file_seek(file, (off_t)position);
-    lock_release(&filesys_lock);
   }
 }
 
@@ -379,10 +603,7 @@ syscall_tell (uint32_t* eax, int fd)
   
   else 
   {
-    /* Lock filesystem, read file position, unlock */
-    lock_acquire(&filesys_lock);
     position = (int) file_tell(file);
-    lock_release(&filesys_lock);
   
     syscall_return_uint (eax, position);
   }
@@ -400,14 +621,8 @@ syscall_close (int fd)
   
   else
   {
-    /* Lock filesystem, close file, unlock */
-    lock_acquire(&filesys_lock);
-    list_remove(&file->elem);
-    if (!file->mmaped) {
-      file_close(file); }
-    else
-      file->closed = true;
-    lock_release(&filesys_lock);
+    fd_table_remove (&thread_current()->process->files, fd);
+    file_close (file);
   }
 
 }
@@ -419,42 +634,45 @@ syscall_mmap  (uint32_t* eax, int fd, const void* addr)
   struct file* file;
   struct mmap_file* mmap;
   off_t read_bytes;
-  uint32_t zero_bytes;
   value = -1; /* Failure return value */
   
-  struct sup_table* sup = thread_current()->process->sup_table;
+  struct process* p = thread_current()->process;
+  struct sup_table* sup = p->sup_table;
   
   if (((int)addr % PGSIZE == 0)
     && ((int)addr != 0)
     && (fd > 1))
   {
     file = find_file (fd);
-    lock_acquire (&filesys_lock);
-
+    lock_acquire (&sup->lock);
     if(   file != NULL 
+       && !inode_is_dir (file_get_inode (file))
        && file_length(file) != 0 
        && check_pages (addr, file_length (file), sup))
     {
-      /* Map file into page here - don't load pages into memory */
+      /* Map file into a region here - don't load pages into memory */
       read_bytes = file_length(file);
-      zero_bytes = PGSIZE - (read_bytes % PGSIZE);
-      if (load_segment(file, 0, (uint8_t*)addr, (uint32_t)read_bytes, zero_bytes, !file->deny_write))
+      mmap = malloc(sizeof(struct mmap_file));
+      if (mmap != NULL
+          && (value = fd_table_add (&p->maps, mmap)) != -1
+          && region_add(sup, (uint8_t*)addr, read_bytes, file, 0,
+                        (uint32_t)read_bytes,
+                        !inode_is_write_denied (file_get_inode (file))) != NULL)
+      {
+        mmap->value = value;
+        mmap->file = file_dup (file);
+        mmap->addr = (void*)addr;
+        mmap->file_size = read_bytes;
+      }
+      else
       {
-        mmap = malloc(sizeof(struct mmap_file));
-        if (mmap != NULL)
-        {
-          value = fd;
-          mmap->value = value;
-          mmap->file = file;
-          mmap->addr = (void*)addr;
-          mmap->file_size = read_bytes;
-          
-          list_push_back(&thread_current()->process->mmaped_files, &mmap->elem);
-        }
+        if (value != -1)
+          fd_table_remove (&p->maps, value);
+        value = -1;
+        free(mmap);
       }
-      file->mmaped = true;
     }
-    lock_release (&filesys_lock);
+    lock_release (&sup->lock);
   }
   
   syscall_return_mapid_t(eax, value);
@@ -475,6 +693,157 @@ syscall_munmap (mapid_t mapid)
   un_map_file (m, true);
 }
 
+/* Writes the modified sectors of a mapping back to its file, keeping
+   it mapped. Returns false for an unknown mapping or a short write. */
+static void
+syscall_msync (uint32_t* eax, mapid_t mapid)
+{
+  struct sup_table* sup = thread_current()->process->sup_table;
+  struct mmap_file* m;
+  struct region* region;
+  struct pagedir_batch batch;
+  struct page* p;
+  uint8_t* upage;
+  bool success = true;
+
+  m = find_mmap(mapid);
+  if (m == NULL)
+  {
+    syscall_return_bool (eax, false);
+    return;
+  }
+
+  /* Untouched pages have no entry and nothing to write */
+  lock_acquire(&sup->lock);
+  pagedir_batch_begin (&batch, thread_current()->pagedir);
+  region = region_find (sup, m->addr);
+  for (upage = region->start; upage < region->end; upage += PGSIZE)
+  {
+    p = page_find (upage, sup);
+    if (p != NULL && !page_write_back (p))
+      success = false;
+  }
+  pagedir_batch_end (&batch);
+  lock_release(&sup->lock);
+
+  syscall_return_bool (eax, success);
+}
+
+/* Copies the process's statistics out to USAGE. Returns 0. */
+static void
+syscall_getrusage (uint32_t* eax, struct rusage* usage)
+{
+  struct rusage kusage;
+
+  process_get_usage (thread_current()->process, &kusage);
+  if (!copy_to_user (usage, &kusage, sizeof kusage))
+    thread_exit();
+  syscall_return_int (eax, 0);
+}
+
+/* Limits the pages the process keeps in memory: to PAGES, to none for
+   RSS_UNLIMITED, or to its working set for RSS_AUTO. Children inherit
+   the limit. Returns false for a limit too small to run with. */
+static void
+syscall_setrss (uint32_t* eax, int pages)
+{
+  syscall_return_bool (eax,
+      page_set_rss_limit (thread_current()->process->sup_table, pages));
+}
+
+/* Changes the current directory to DIR. Returns false if there is no
+   such directory */
+static void
+syscall_chdir (uint32_t* eax, const char* dir)
+{
+  bool success;
+  char* name = copy_string(dir);
+  if (name == NULL)
+  {
+    syscall_return_bool (eax, false);
+    return;
+  }
+
+  success = filesys_chdir(name);
+  palloc_free_page(name);
+
+  syscall_return_bool (eax, success);
+}
+
+/* Creates the empty directory DIR. Returns false if it exists already
+   or its parent does not */
+static void
+syscall_mkdir (uint32_t* eax, const char* dir)
+{
+  bool success;
+  char* name = copy_string(dir);
+  if (name == NULL)
+  {
+    syscall_return_bool (eax, false);
+    return;
+  }
+
+  success = filesys_mkdir(name);
+  palloc_free_page(name);
+
+  syscall_return_bool (eax, success);
+}
+
+/* Copies the name of the next entry of directory FD out to NAME,
+   which has room for READDIR_MAX_LEN + 1 bytes. The position is kept
+   in the file's. Returns false at the end, or if FD is not a
+   directory */
+static void
+syscall_readdir (uint32_t* eax, int fd, char* name)
+{
+  char kname[NAME_MAX + 1];
+  struct file* file;
+  struct dir* dir;
+  bool success = false;
+
+  file = find_file (fd);
+  if (file == NULL || !inode_is_dir (file_get_inode (file)))
+  {
+    syscall_return_bool (eax, false);
+    return;
+  }
+
+  dir = dir_open (inode_reopen (file_get_inode (file)));
+  if (dir != NULL)
+  {
+    dir_seek (dir, file_tell (file));
+    success = dir_readdir (dir, kname);
+    file_seek (file, dir_tell (dir));
+    dir_close (dir);
+  }
+
+  if (success && !copy_to_user (name, kname, strlen (kname) + 1))
+    thread_exit();
+  syscall_return_bool (eax, success);
+}
+
+/* Returns true if FD is a directory */
+static void
+syscall_isdir (uint32_t* eax, int fd)
+{
+  struct file* file = find_file (fd);
+
+  syscall_return_bool (eax,
+      file != NULL && inode_is_dir (file_get_inode (file)));
+}
+
+/* Returns the inode number of FD, or -1 if it is not open */
+static void
+syscall_inumber (uint32_t* eax, int fd)
+{
+  struct file* file = find_file (fd);
+
+  if (file == NULL)
+    syscall_return_int (eax, -1);
+  else
+    syscall_return_int (eax, inode_get_inumber (file_get_inode (file)));
+}
+
 /* Function for unmapping - bool kill_thread for when called in syscall_munmap 
    and failure means killing thread - this function is also called in process 
    exit which is called by thread_exit - if this bool was true could create an unwanted loop */
@@ -482,10 +851,12 @@ void
 un_map_file (struct mmap_file* m, bool kill_thread)
 {
   struct sup_table* sup;
-  unsigned int i;
+  struct region* region;
+  struct pagedir_batch batch;
+  uint8_t* upage;
   struct page* p;
   struct file* file;
-  int write_size;
+  bool failed = false;
   
   sup = thread_current()->process->sup_table;
   
@@ -493,51 +864,41 @@ un_map_file (struct mmap_file* m, bool kill_thread)
   
   //putbuf(m->addr, file_length(file));
 
-  /*  Go through pages for mapped file - if the page is null do nothing 
+  /*  Go through pages for mapped file - if the page is null it was never
+      touched (or was evicted clean) - do nothing 
       If it hasn't been loaded - do nothing
       If its in memory, check dirty bit
-      If its not in memory and it has been written to - write it back */
-  for (i = 0; i <= m->file_size / PGSIZE ; i++)
+      If its not in memory and it has been written to - write it back.
+      Holding our page table lock keeps the pages from being evicted
+      while they are written back. */
+  lock_acquire(&sup->lock);
+  pagedir_batch_begin (&batch, thread_current()->pagedir);
+  region = region_find (sup, m->addr);
+  for (upage = region->start; upage < region->end && !failed; upage += PGSIZE)
   {
-    p = page_find ((uint8_t*)m->addr + (i * PGSIZE), sup);
+    p = page_find (upage, sup);
     if(p == NULL)
-    {
-      if(kill_thread)
-        thread_exit();
-    }
-    else if (p->loaded)
-    {
-      if (p->valid)
-      {
-        /* For the pages in memory, go through and see if they've been modified */
-        if (pagedir_is_dirty (thread_current()->pagedir, (const void*)p->upage))
-        {
-          /* If the number of bytes written isn't the same as expected, kill the thread */
-          lock_acquire(&filesys_lock);
-          write_size = (int)file_write_at(p->file, (const void*)(p->upage),(off_t)p->read_bytes,p->ofs);
-          //printf("write size = %d\n",write_size);
-          lock_release(&filesys_lock);
-          
-          if ((write_size != (off_t)p->read_bytes) && kill_thread)
-            thread_exit();
-        }
-      }
-    }
+      continue;
+
+    /* For the pages in memory, write them back if they've been modified.
+       If the number of bytes written isn't the same as expected, kill the thread */
+    if (!page_write_back (p) && kill_thread)
+      failed = true;
     
     page_table_remove(p,sup);
   }
+  if (!failed)
+    region_remove (region);
+  pagedir_batch_end (&batch);
+  lock_release(&sup->lock);
+
+  if (failed)
+    thread_exit();
   
-  file->mmaped = false;
-  
-  /* If the process has closed the file - actually close the file */
-  if (m->file->closed)
-  {
-    lock_acquire(&filesys_lock);
-    file_close(m->file);
-    lock_release(&filesys_lock);
-  }
+  /* The file stays open while a descriptor still refers to it */
+  file_close (file);
   
-  list_remove(&m->elem);
+  fd_table_remove (&thread_current()->process->maps, m->value);
   free(m);
 }
 
@@ -580,90 +941,51 @@ syscall_return_mapid_t (uint32_t* eax, const mapid_t value)
 static struct file*
 find_file(int fd)
 {
-  struct thread* t;
-  struct list_elem* e;
-  struct file* file;
- 
-  t = thread_current();
-  for (e = list_begin (&t->process->open_files); e != list_end (&t->process->open_files);
-     e = list_next (e)) 
-    {
-      file = list_entry (e, struct file, elem);
-      if(file->fd == fd)
-        return file; 
-    }
-  return NULL;
+  return fd_table_get (&thread_current()->process->files, fd);
 }
 
+/* Returns the mapping with the given mapid */
 static struct mmap_file*
 find_mmap (mapid_t id)
 {
-  struct process* p;
-  struct list_elem* e;
-  struct mmap_file* m;
- 
-  p = thread_current()->process;
-  
-  for (e = list_begin (&p->mmaped_files); e != list_end (&p->mmaped_files);
-     e = list_next (e)) 
-    {
-      m = list_entry (e, struct mmap_file, elem);
-      if(m->value == id)
-        return m; 
-    }
-  return NULL;
+  return fd_table_get (&thread_current()->process->maps, id);
 }
 
-/* Checks the buffer is safe by checking at each buffer + PGSIZE */
+/* Copies the call number and NO_ARGS arguments from the user stack at
+   ESP into ARGS, killing the process if they can't be read */
 static void 
-check_buffer_safety (const void* buffer, int size, bool write)
+copy_args (const void* esp, uint32_t* args, int no_args)
 {
-  int i;
-  struct page* page;
-  void* temp;
-    
-  /* Check if the buffer and that the end of the buffer are safe */
-  if (!is_safe_ptr(buffer + size))
+  if (!copy_from_user (args, esp, (no_args + 1) * sizeof(uint32_t)))
     thread_exit();
-  
-  /* Check if at each PGSIZE interval the buffer is safe */
-  for(i = 0; i <= size / PGSIZE ; i++)
-  {
-    temp = (void*)buffer + (i*PGSIZE);
-    if( !is_safe_ptr(temp))
-      thread_exit();
-    else if (write) {
-      page = page_find (lower_page_bound(temp), thread_current()->process->sup_table);
-      if (page != NULL && !page->writable)
-        thread_exit();
-    }
-  }
 }
 
-/* Given the number of arguments, checks that they are all safe pointers*/
-static void 
-check_safe_ptr (const void* ptr, int no_args)
+/* Returns a copy of the user string USTR in a new page, to be freed
+   with palloc_free_page(), or NULL if out of memory. Kills the process
+   if USTR can't be read or is longer than a page. */
+static char*
+copy_string (const char* ustr)
 {
-  int i;
-  for(i = 0; i < no_args; i++)
-    if (!is_safe_ptr(ptr + (i * sizeof(uint32_t))))
-      thread_exit();
+  char* kstr = palloc_get_page(0);
+  if (kstr == NULL)
+    return NULL;
+
+  if (strncpy_from_user (kstr, ustr, PGSIZE) == -1)
+  {
+    palloc_free_page(kstr);
+    thread_exit();
+  }
+  return kstr;
 }
 
-/* Checks that none of the pages have already been allocated */
+/* Checks that none of the pages are already mapped */
 static bool
 check_pages (const void* addr, int size, struct sup_table* sup)
 {
-  int i;
   /* Check that we're not going to try and go inside the stack */
-  if ((uint32_t*)MAX_STACK_ADDRESS < (uint32_t*)addr 
-       || (uint32_t*)MAX_STACK_ADDRESS < (uint32_t*)addr + size)
+  if ((uint8_t*)MAX_STACK_ADDRESS < (uint8_t*)addr 
+       || (uint8_t*)MAX_STACK_ADDRESS - (uint8_t*)addr < size)
     return false;
   
-  for (i = 0; i <= size / PGSIZE ; i++) {
-    if (page_find ((uint8_t*)addr + (i * PGSIZE), sup) != NULL)
-      return false;
-  }
-    
-  return true;
+  return !region_overlaps (sup, addr, ROUND_UP (size, PGSIZE));
 }
\ No newline at end of file
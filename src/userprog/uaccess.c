@@ -0,0 +1,103 @@
+#include "userprog/uaccess.h"
+#include "threads/vaddr.h"
+
+/* An instruction that may fault on a user address, and where to go
+   on instead if it does. The entries are emitted next to the
+   instructions by EX_TABLE and collected in one section by the
+   linker script (threads/kernel.lds.S). */
+struct ex_entry
+{
+  uint32_t insn;        /* Address of the faulting instruction */
+  uint32_t fixup;       /* Address to resume at */
+};
+
+extern const struct ex_entry _start_ex_table[], _end_ex_table[];
+
+#define EX_TABLE(INSN, FIXUP)                   \
+        ".pushsection __ex_table, \"a\"\n"      \
+        ".long " #INSN ", " #FIXUP "\n"         \
+        ".popsection\n"
+
+/* Copies SIZE bytes from SRC to DST. If a page fault can't be
+   resolved part way through, gives up and returns the number of bytes
+   left, thanks to "rep movsb" keeping its count in ECX. */
+static inline size_t
+copy_bytes (void* dst, const void* src, size_t size)
+{
+  asm volatile ("1: rep movsb\n"
+                "2:\n"
+                EX_TABLE (1b, 2b)
+                : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+  return size;
+}
+
+/* Reads the byte at user address UADDR. Returns the byte, or -1 if
+   the read faulted - EAX is only written by a completed load. */
+static inline int
+get_user (const uint8_t* uaddr)
+{
+  int result = -1;
+  asm volatile ("1: movzbl %1, %0\n"
+                "2:\n"
+                EX_TABLE (1b, 2b)
+                : "+a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Copies SIZE bytes from user address USRC to DST. Returns false if
+   any of them can't be read. */
+bool
+copy_from_user (void* dst, const void* usrc, size_t size)
+{
+  return is_user_range (usrc, size) && copy_bytes (dst, usrc, size) == 0;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST. Returns false if
+   any of them can't be written, in which case some may have been. */
+bool
+copy_to_user (void* udst, const void* src, size_t size)
+{
+  return is_user_range (udst, size) && copy_bytes (udst, src, size) == 0;
+}
+
+/* Copies the string at user address USRC into DST, which has room for
+   SIZE bytes. Returns the length of the string, or -1 if it can't be
+   read or doesn't fit. */
+int
+strncpy_from_user (char* dst, const char* usrc, size_t size)
+{
+  size_t i;
+  int c;
+
+  for (i = 0; i < size; i++)
+  {
+    if (!is_user_vaddr (usrc + i) || (c = get_user ((const uint8_t*)usrc + i)) == -1)
+      return -1;
+    dst[i] = c;
+    if (c == '\0')
+      return i;
+  }
+  return -1;
+}
+
+/* Returns where to resume after a page fault at EIP in the kernel that
+   could not be resolved, or 0 if EIP is not a user access. */
+uint32_t
+uaccess_fixup (uint32_t eip)
+{
+  const struct ex_entry* e;
+
+  for (e = _start_ex_table; e < _end_ex_table; e++)
+    if (e->insn == eip)
+      return e->fixup;
+  return 0;
+}
+
+/* True if SIZE bytes from UADDR are all below PHYS_BASE. Says nothing
+   about whether they are mapped. */
+bool
+is_user_range (const void* uaddr, size_t size)
+{
+  return is_user_vaddr (uaddr)
+         && size <= (size_t)((const uint8_t*)PHYS_BASE - (const uint8_t*)uaddr);
+}
@@ -0,0 +1,23 @@
+#ifndef USERPROG_UACCESS_H
+#define USERPROG_UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Access to user memory from the kernel. Nothing is looked up in
+   advance: the access just happens, pages that are not in memory are
+   faulted in by page_fault() as for the process itself, and a bad
+   address makes the access fail instead of panicking the kernel.
+
+   These must not be called while holding the process's sup_table
+   lock or any file system lock, which page_fault() may need. */
+
+bool copy_from_user (void* dst, const void* usrc, size_t size);
+bool copy_to_user (void* udst, const void* src, size_t size);
+int strncpy_from_user (char* dst, const char* usrc, size_t size);
+bool is_user_range (const void* uaddr, size_t size);
+
+uint32_t uaccess_fixup (uint32_t eip);
+
+#endif /* userprog/uaccess.h */
@@ -4,6 +4,11 @@
 #include "threads/vaddr.h"
 #include "threads/thread.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/exception.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include <string.h>
 
 //TODO: remove (debug)
 #include <stdio.h>
@@ -11,8 +16,27 @@
 static struct frame** table;
 static unsigned int count;
 
-static void frame_add(unsigned int frame_index, struct page* sup_page);
-static void frame_del(unsigned int frame_index);
+/* Read-only file pages already in memory, keyed by (inode, offset), so
+   every process running the same binary maps the same frames */
+static struct hash page_cache;
+
+/* Guards TABLE, PAGE_CACHE, the mapper lists and the pin counts. Only
+   held while a victim is chosen, never across disk I/O. */
+static struct lock frame_lock;
+
+static struct frame* frame_add(void* kpage, struct page* sup_page);
+static void frame_del(struct frame* f);
+static struct frame* page_to_frame(struct page* sup_page);
+static int frame_score(struct frame* f);
+static bool frame_lock_mappers(struct frame* f);
+static void frame_unlock_mappers(struct frame* f, struct list_elem* end);
+static void frame_unlock_sup(struct sup_table* sup);
+static void* frame_evict(struct sup_table* only);
+static void* frame_alloc(enum palloc_flags flags, struct page* sup_page);
+static bool frame_private_to(struct frame* f, struct sup_table* sup);
+
+static unsigned cache_hash (const struct hash_elem* e, void* aux);
+static bool cache_less (const struct hash_elem* a, const struct hash_elem* b, void* aux);
 
 void
 frame_init(int _count)
@@ -20,7 +44,9 @@ frame_init(int _count)
   unsigned int i;
   count = _count;
   table = malloc(sizeof(void*) * count);
-  
+  lock_init(&frame_lock);
+  hash_init(&page_cache, cache_hash, cache_less, NULL);
+
   /* Initialise (struct frame) pointers */
   for(i=0;i<count;i++)
   {
@@ -28,95 +54,514 @@ frame_init(int _count)
   }
 }
 
-static void
-frame_add(unsigned int frame_index, struct page* sup_page)
+static struct frame*
+frame_add(void* kpage, struct page* sup_page)
 {
+  unsigned int frame_index = page_to_frame_idx(kpage);
+  struct frame* f;
+
   ASSERT(table[frame_index] == NULL);
-  table[frame_index] = malloc(sizeof(struct frame));
-  table[frame_index]->sup_page = sup_page;
+  f = table[frame_index] = malloc(sizeof(struct frame));
+  f->kpage = kpage;
+  list_init(&f->mappers);
+  list_push_back(&f->mappers, &sup_page->frame_elem);
+  f->ref_cnt = 1;
+  f->pin_cnt = 0;
+  f->cold = false;
+  f->cached = false;
+  return f;
 }
 
 static void
-frame_del(unsigned int frame_index)
+frame_del(struct frame* f)
 {
-  ASSERT(table[frame_index] != NULL);
-  free(table[frame_index]);
+  unsigned int frame_index = page_to_frame_idx(f->kpage);
+
+  ASSERT(table[frame_index] == f);
+  if(f->cached)
+    hash_delete(&page_cache, &f->cache_elem);
+  free(f);
   table[frame_index] = NULL;
 }
 
+static struct frame*
+page_to_frame(struct page* sup_page)
+{
+  ASSERT(sup_page->valid);
+  return table[page_to_frame_idx(sup_page->kpage)];
+}
+
+/* Best possible frame_score() */
+#define SCORE_MAX 5
 
-void*
-frame_get(enum palloc_flags flags, struct page* sup_page)
+/* Not accessed and clean frames are the cheapest to evict, and those a
+   sequential reader has finished with are cheaper still. A shared
+   frame counts as accessed if any of its mappers accessed it. */
+static int
+frame_score(struct frame* f)
 {
-  void* kpage;
-  struct frame* best = NULL;
-  int best_score = 0;
-  int current_score = 0;
-  uint32_t* pd;
-  unsigned int i;
-  bool accessed, dirty;
-  
-  ASSERT(sup_page->upage != NULL);
+  struct list_elem* e;
+  struct page* p;
+  bool accessed = false, dirty = false;
 
-  kpage = palloc_get_page(PAL_USER | flags);
+  for(e = list_begin(&f->mappers); e != list_end(&f->mappers); e = list_next(e))
+  {
+    p = list_entry(e, struct page, frame_elem);
+    accessed |= pagedir_is_accessed(p->owner->pagedir, p->upage);
+    dirty |= pagedir_is_dirty(p->owner->pagedir, p->upage);
+  }
 
-  /* Evict if necessary */
-  if(kpage == NULL)
+  if(f->cold && !accessed)
+    return dirty ? 4 : SCORE_MAX;
+  else if(!accessed && !dirty)
+    return 4;
+  else if(accessed && !dirty)
+    return 3;
+  else if(!accessed && dirty)
+    return 2;
+  else
+    return 1;
+}
+
+/* Takes the sup_table lock of every process mapping F without
+   blocking, so that an evicting process never waits on another process
+   which is itself faulting. Returns true if the caller now holds all of
+   them, otherwise holds none it did not hold before.
+   Locks the caller already held for its own purposes (its own table, or
+   its parent's during fork()) are left alone; the ones taken here are
+   counted in evict_refs, as the current best victim may share them. */
+static bool
+frame_lock_mappers(struct frame* f)
+{
+  struct list_elem* e;
+  struct sup_table* sup;
+
+  for(e = list_begin(&f->mappers); e != list_end(&f->mappers); e = list_next(e))
+  {
+    sup = list_entry(e, struct page, frame_elem)->owner->process->sup_table;
+    if(lock_held_by_current_thread(&sup->lock))
+    {
+      if(sup->evict_refs > 0)
+        sup->evict_refs++;
+    }
+    else if(lock_try_acquire(&sup->lock))
+      sup->evict_refs = 1;
+    else
+    {
+      frame_unlock_mappers(f, e);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Releases the mapper locks taken by frame_lock_mappers(), for the
+   mappers of F before END */
+static void
+frame_unlock_mappers(struct frame* f, struct list_elem* end)
+{
+  struct sup_table* sup;
+  struct list_elem* e;
+
+  for(e = list_begin(&f->mappers); e != end; e = list_next(e))
+  {
+    sup = list_entry(e, struct page, frame_elem)->owner->process->sup_table;
+    frame_unlock_sup(sup);
+  }
+}
+
+static void
+frame_unlock_sup(struct sup_table* sup)
+{
+  if(sup->evict_refs > 0 && --sup->evict_refs == 0)
+    lock_release(&sup->lock);
+}
+
+/* Chooses an unpinned frame, writes its page(s) out and returns the
+   (still allocated) frame for reuse. If ONLY is not NULL the frame is
+   one of ONLY's own, unshared frames, and NULL is returned if it has
+   none to give. */
+static void*
+frame_evict(struct sup_table* only)
+{
+  struct frame* best;
+  struct frame* f;
+  struct list_elem* e;
+  struct list_elem* next;
+  struct page* p;
+  struct sup_table* sup;
+  int best_score, current_score;
+  unsigned int i;
+  void* kpage;
+
+  for(;;)
   {
-    for(i=0; i<count; i++)
+    best = NULL;
+    best_score = 0;
+
+    lock_acquire(&frame_lock);
+    for(i=0; i<count && best_score < SCORE_MAX; i++)
     {
-      if(table[i] != NULL)
+      f = table[i];
+      if(f == NULL || f->pin_cnt > 0)
+        continue;
+      if(only != NULL && !frame_private_to(f, only))
+        continue;
+
+      current_score = frame_score(f);
+      if(current_score > best_score && frame_lock_mappers(f))
       {
-        pd = table[i]->sup_page->owner->pagedir;
-        accessed = pagedir_is_accessed(pd, table[i]->sup_page->upage);
-        dirty = pagedir_is_dirty(pd, table[i]->sup_page->upage);
-        
-        if(!accessed && !dirty)
-          current_score = 4;
-        if(accessed && !dirty)
-          current_score = 3;
-        if(!accessed && dirty)
-          current_score = 2;
-        else
-          current_score = 1;
-
-        if(current_score >= best_score)
-        {
-          best = table[i];
-          best_score = current_score;
-        }
+        if(best != NULL)
+          frame_unlock_mappers(best, list_end(&best->mappers));
+        best = f;
+        best_score = current_score;
       }
     }
-    
-    swap_out(best->sup_page);
-    /* Swap out some page */
-    
-    /* Try again */
+
+    if(best != NULL)
+      break;
+
+    /* Every frame is pinned or its owner is busy faulting - let them
+       make progress and try again */
+    lock_release(&frame_lock);
+    if(only != NULL)
+      return NULL;
+    thread_yield();
+  }
+
+  /* Keep other evicters away while the page is written out, and stop
+     new processes from sharing a frame which is about to be reused */
+  best->pin_cnt++;
+  if(best->cached)
+  {
+    hash_delete(&page_cache, &best->cache_elem);
+    best->cached = false;
+  }
+  lock_release(&frame_lock);
+
+  /* Every mapper loses the page. Pages that are now just what their
+     region says are dropped altogether - unless the owner is us, or
+     another process we are working for, which may be using them. */
+  kpage = best->kpage;
+  for(e = list_begin(&best->mappers); e != list_end(&best->mappers); e = next)
+  {
+    next = list_next(e);
+    p = list_entry(e, struct page, frame_elem);
+    sup = p->owner->process->sup_table;
+
+    swap_out(p);
+    sup->process->usage.evictions++;
+    if(sup->evict_refs > 0 && !p->loaded && p->swap_idx == NOT_YET_SWAPPED)
+      page_forget(p);
+    frame_unlock_sup(sup);
+  }
+
+  lock_acquire(&frame_lock);
+  frame_del(best);
+  lock_release(&frame_lock);
+
+  return kpage;
+}
+
+/* Is F mapped by SUP's pages alone */
+static bool
+frame_private_to(struct frame* f, struct sup_table* sup)
+{
+  return f->ref_cnt == 1
+         && list_entry(list_front(&f->mappers), struct page,
+                       frame_elem)->owner->process->sup_table == sup;
+}
+
+/* Returns a free user frame for SUP_PAGE, evicting one if necessary.
+   A process at its resident set limit replaces one of its own pages
+   instead, as long as it has one that is not pinned or shared. */
+static void*
+frame_alloc(enum palloc_flags flags, struct page* sup_page)
+{
+  struct sup_table* sup = sup_page->owner->process->sup_table;
+  void* kpage = NULL;
+  int64_t start;
+
+  /* Evict if necessary - the evicted frame is handed straight to us,
+     so nobody can take it between the eviction and our allocation */
+  if(sup->rss_limit != 0 && sup->resident >= sup->rss_limit)
+  {
+    start = timer_cycles();
+    kpage = frame_evict(sup);
+    exception_time_phase(FAULT_EVICT, start);
+  }
+  if(kpage == NULL)
     kpage = palloc_get_page(PAL_USER | flags);
+  else if(flags & PAL_ZERO)
+    memset(kpage, 0, PGSIZE);
+
+  if(kpage == NULL)
+  {
+    start = timer_cycles();
+    kpage = frame_evict(NULL);
+    exception_time_phase(FAULT_EVICT, start);
+    if(flags & PAL_ZERO)
+      memset(kpage, 0, PGSIZE);
   }
-  
-  frame_add(page_to_frame_idx(kpage), sup_page);
-  
-  /* Add to page directory */
-  ASSERT(install_page(sup_page->upage, kpage, sup_page->writable));
-  
+  return kpage;
+}
+
+void*
+frame_get(enum palloc_flags flags, struct page* sup_page)
+{
+  void* kpage;
+
+  ASSERT(sup_page->upage != NULL);
+
+  kpage = frame_alloc(flags, sup_page);
+
+  lock_acquire(&frame_lock);
+  frame_add(kpage, sup_page);
+  lock_release(&frame_lock);
+
+  sup_page->kpage = kpage;
+
+  /* Add to page directory - mmap pages read-only until first written,
+     so we know which of their sectors change */
+  sup_page->clean_wp = page_is_mmap(sup_page);
+  ASSERT(install_page(sup_page->upage, kpage,
+                      sup_page->writable && !sup_page->clean_wp));
+
   /* Set supplementary page "in physical memory" flag */
   sup_page->valid = true;
-  
+  sup_page->cow = false;
+  sup_page->owner->process->sup_table->resident++;
+
   return kpage;
 }
 
-/* Called from page_free to free a page which is in physical memory */
+/* Called from page_free to free a page which is in physical memory.
+   The frame itself is only released once its last mapper is gone. */
 void
 frame_free(struct page* sup_page)
 {
+  struct frame* f;
   void* kpage;
-  
+  bool last;
+
   ASSERT(sup_page->valid);
-  
-  sup_page->valid = false;
-  kpage = pagedir_get_page(sup_page->owner->pagedir, sup_page->upage);
+
+  kpage = sup_page->kpage;
   pagedir_clear_page(sup_page->owner->pagedir, sup_page->upage);
-  palloc_free_page(kpage);
-  frame_del(page_to_frame_idx(kpage));
+
+  lock_acquire(&frame_lock);
+  f = page_to_frame(sup_page);
+  list_remove(&sup_page->frame_elem);
+  last = --f->ref_cnt == 0;
+  if(last)
+    frame_del(f);
+  lock_release(&frame_lock);
+
+  sup_page->valid = false;
+  sup_page->owner->process->sup_table->resident--;
+  if(last)
+    palloc_free_page(kpage);
+}
+
+/* Stops the frame holding SUP_PAGE from being evicted, e.g. while the
+   kernel does I/O straight into it. SUP_PAGE must be in memory. */
+void
+frame_pin(struct page* sup_page)
+{
+  lock_acquire(&frame_lock);
+  page_to_frame(sup_page)->pin_cnt++;
+  lock_release(&frame_lock);
+}
+
+void
+frame_unpin(struct page* sup_page)
+{
+  struct frame* f;
+
+  lock_acquire(&frame_lock);
+  f = page_to_frame(sup_page);
+  ASSERT(f->pin_cnt > 0);
+  f->pin_cnt--;
+  lock_release(&frame_lock);
+}
+
+/* Looks for SUP_PAGE's file page in the page cache and, if another
+   process already has it in memory, maps that frame read-only into
+   the current process. Returns true if SUP_PAGE is now valid. */
+bool
+frame_cache_map(struct page* sup_page)
+{
+  struct frame key;
+  struct hash_elem* e;
+  struct frame* f = NULL;
+
+  ASSERT(sup_page->file != NULL && !sup_page->writable);
+
+  key.inode = file_get_inode(sup_page->file);
+  key.ofs = sup_page->ofs;
+  key.read_bytes = sup_page->read_bytes;
+
+  lock_acquire(&frame_lock);
+  e = hash_find(&page_cache, &key.cache_elem);
+  if(e != NULL)
+  {
+    f = hash_entry(e, struct frame, cache_elem);
+    list_push_back(&f->mappers, &sup_page->frame_elem);
+    f->ref_cnt++;
+  }
+  lock_release(&frame_lock);
+
+  if(f == NULL)
+    return false;
+
+  /* The frame cannot be evicted before we are mapped: any evicter now
+     needs our sup_table lock, which the caller holds */
+  sup_page->kpage = f->kpage;
+  ASSERT(install_page(sup_page->upage, f->kpage, false));
+  sup_page->valid = true;
+  sup_page->owner->process->sup_table->resident++;
+  return true;
+}
+
+/* Publishes SUP_PAGE's freshly loaded read-only file page in the page
+   cache, so later mappers of the same file page share its frame. */
+void
+frame_cache_add(struct page* sup_page)
+{
+  struct frame* f;
+
+  ASSERT(sup_page->file != NULL && !sup_page->writable);
+
+  lock_acquire(&frame_lock);
+  f = page_to_frame(sup_page);
+  f->inode = file_get_inode(sup_page->file);
+  f->ofs = sup_page->ofs;
+  f->read_bytes = sup_page->read_bytes;
+
+  /* Somebody may have loaded the same page at the same time - theirs
+     stays the shared copy and ours stays private */
+  f->cached = hash_insert(&page_cache, &f->cache_elem) == NULL;
+  lock_release(&frame_lock);
+}
+
+/* Maps FROM's frame at the same address in the current process, a
+   fork() child, as its page TO. A writable frame becomes read-only in
+   both processes until one of them writes to it (see frame_unshare).
+   The caller holds both processes' sup_table locks. */
+void
+frame_share(struct page* from, struct page* to)
+{
+  struct frame* f;
+  uint32_t* pd = from->owner->pagedir;
+  bool dirty;
+
+  lock_acquire(&frame_lock);
+  f = page_to_frame(from);
+  list_push_back(&f->mappers, &to->frame_elem);
+  f->ref_cnt++;
+  lock_release(&frame_lock);
+
+  /* Our copy is only known to match the backing file if the parent's
+     is - otherwise it must be written out if evicted */
+  dirty = pagedir_is_dirty(pd, from->upage) || from->swap_idx != NOT_YET_SWAPPED;
+
+  if(from->writable)
+  {
+    pagedir_set_writable(pd, from->upage, false);
+    from->cow = true;
+  }
+
+  to->kpage = f->kpage;
+  ASSERT(install_page(to->upage, f->kpage, false));
+  pagedir_set_dirty(to->owner->pagedir, to->upage, dirty);
+  to->valid = true;
+  to->owner->process->sup_table->resident++;
+  to->loaded = from->loaded;
+  to->cow = to->writable;
+}
+
+/* Breaks the copy-on-write sharing of SUP_PAGE on a write: the last
+   mapper of a frame just gets it back writable, the others copy it
+   into a new frame of their own. The caller holds our sup_table lock. */
+void
+frame_unshare(struct page* sup_page)
+{
+  struct frame* old;
+  uint32_t* pd = sup_page->owner->pagedir;
+  void* kpage;
+  void* old_kpage;
+  bool last;
+
+  ASSERT(sup_page->valid && sup_page->cow);
+
+  lock_acquire(&frame_lock);
+  old = page_to_frame(sup_page);
+  if(old->ref_cnt == 1)
+  {
+    lock_release(&frame_lock);
+    pagedir_set_writable(pd, sup_page->upage, true);
+    sup_page->cow = false;
+    return;
+  }
+
+  /* The other mappers may not hold our lock, so keep evicters off the
+     frame while it is copied */
+  old->pin_cnt++;
+  lock_release(&frame_lock);
+
+  kpage = frame_alloc(0, sup_page);
+  old_kpage = old->kpage;
+  memcpy(kpage, old_kpage, PGSIZE);
+
+  lock_acquire(&frame_lock);
+  old->pin_cnt--;
+  list_remove(&sup_page->frame_elem);
+  last = --old->ref_cnt == 0;
+  if(last)
+    frame_del(old);
+  frame_add(kpage, sup_page);
+  lock_release(&frame_lock);
+
+  if(last)
+    palloc_free_page(old_kpage);
+
+  pagedir_clear_page(pd, sup_page->upage);
+  sup_page->kpage = kpage;
+  ASSERT(install_page(sup_page->upage, kpage, true));
+  pagedir_set_dirty(pd, sup_page->upage, true);
+  sup_page->cow = false;
+}
+
+/* Marks the frame of SUP_PAGE, which must be in memory, as one its
+   user is done with, so it is evicted before any other */
+void
+frame_set_cold(struct page* sup_page)
+{
+  lock_acquire(&frame_lock);
+  page_to_frame(sup_page)->cold = true;
+  lock_release(&frame_lock);
+
+  pagedir_set_accessed(sup_page->owner->pagedir, sup_page->upage, false);
+}
+
+/* Page cache hash functions */
+
+static unsigned
+cache_hash (const struct hash_elem* e, void* aux UNUSED)
+{
+  const struct frame* f = hash_entry(e, struct frame, cache_elem);
+  return hash_int((uint32_t)f->inode ^ (uint32_t)f->ofs);
+}
+
+static bool
+cache_less (const struct hash_elem* a_, const struct hash_elem* b_, void* aux UNUSED)
+{
+  const struct frame* a = hash_entry(a_, struct frame, cache_elem);
+  const struct frame* b = hash_entry(b_, struct frame, cache_elem);
+
+  if(a->inode != b->inode)
+    return a->inode < b->inode;
+  if(a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
 }
@@ -1,12 +1,37 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
 #include "threads/synch.h"
 #include "vm/page.h"
 #include "threads/palloc.h"
+#include "filesys/off_t.h"
+#include <hash.h>
+#include <list.h>
 
 struct frame {
-  struct page* sup_page;
-  // TODO: Add extra information for eviction
+  void* kpage;                  /* Kernel virtual address of the frame */
+  struct list mappers;          /* Pages mapping this frame (page->frame_elem) */
+  unsigned int ref_cnt;         /* Number of mappers */
+  int pin_cnt;                  /* Pinned frames are never chosen for eviction */
+  bool cold;                    /* Left behind by a sequential reader - evict first */
+
+  /* Page cache entry - only for shared read-only file pages */
+  bool cached;                  /* Is the frame in the page cache */
+  struct inode* inode;          /* Backing inode */
+  off_t ofs;                    /* Offset of the page in the inode */
+  uint32_t read_bytes;          /* Bytes of the page that come from the inode */
+  struct hash_elem cache_elem;  /* Page cache element */
 };
 
 void frame_init(int count);
 void* frame_get(enum palloc_flags flags, struct page* sup_page);
 void frame_free(struct page* sup_page);
+void frame_pin(struct page* sup_page);
+void frame_unpin(struct page* sup_page);
+bool frame_cache_map(struct page* sup_page);
+void frame_cache_add(struct page* sup_page);
+void frame_share(struct page* from, struct page* to);
+void frame_unshare(struct page* sup_page);
+void frame_set_cold(struct page* sup_page);
+
+#endif /* vm/frame.h */
@@ -3,11 +3,15 @@
 #include "vm/swap.h"
 #include "userprog/process.h"
 #include <hash.h>
+#include <round.h>
 #include <string.h>
 #include "threads/malloc.h"
 #include "threads/vaddr.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "userprog/exception.h"
 
 
 
@@ -15,23 +19,28 @@
 #include <stdio.h>
 #include "userprog/pagedir.h"
 
-//TODO: Finish synchronisation
-
 static bool page_less (const struct hash_elem* p1, const struct hash_elem* p2, void* aux);
 static unsigned page_hash (const struct hash_elem* elem, void* aux);
 static void page_destroy (struct hash_elem* e, void* aux);
-static void page_copy (struct hash_elem* e, void* sup_table);
 static void print_page (struct hash_elem* e, void* aux UNUSED);
-
-/* Mutually exclusive access to frame/swap management 
-   and supplementary page table access */
-static struct lock vm_lock;
+static bool page_shareable (const struct page* p);
+static void page_bring_in (struct page* p);
+static void page_read_ahead (struct region* r, uint8_t* upage, uint8_t* end);
+static void page_drop_behind (struct sup_table* sup, uint8_t* start, uint8_t* end);
 
 
 bool
 page_table_init (struct sup_table* sup) 
 {
-  lock_init(&vm_lock);
+  lock_init(&sup->lock);
+  sup->evict_refs = 0;
+  sup->resident = 0;
+  sup->rss_limit = 0;
+  sup->rss_auto = false;
+  sup->wss = 0;
+  sup->ws_faults = 0;
+  sup->ws_sampled = 0;
+  list_init(&sup->regions);
   return hash_init(&sup->page_table, page_hash, page_less, NULL);
 }
 
@@ -86,68 +95,431 @@ page_find (uint8_t* upage, struct sup_table* sup)
   return hash_entry(value, struct page, elem);
 }
 
-uint32_t*
-lookup_sup_page(struct process* process, const void* vaddr)
-{
-  
-  struct sup_table* sup = process->sup_table;
-  
-  struct page* ptr = page_find((uint8_t*)vaddr, sup);
-  if (ptr != NULL)
-    return (uint32_t*)ptr->upage;
-  
-  return NULL;
-  
-}
-
 void
 page_table_destroy(struct sup_table* sup)
 {
+  struct pagedir_batch batch;
+
+  lock_acquire(&sup->lock);
+  /* One TLB flush for the lot, not one per page */
+  pagedir_batch_begin(&batch, thread_current()->pagedir);
   hash_destroy(&sup->page_table, page_destroy);
+  pagedir_batch_end(&batch);
+  region_destroy(sup);
+  lock_release(&sup->lock);
   free(sup);
 }
 
+/* Gives the current process, a fork() child of PARENT, a copy of
+   PARENT's regions and of every page of PARENT. Pages in memory are
+   shared with the parent (copy-on-write if writable) and pages in swap
+   are copied; the others will be loaded from the child's own files. */
+bool
+page_table_fork(struct process* parent)
+{
+  struct sup_table* sup = thread_current()->process->sup_table;
+  struct hash_iterator i;
+  struct page* from;
+  struct page* to;
+  bool success = true;
+
+  lock_acquire(&sup->lock);
+  lock_acquire(&parent->sup_table->lock);
+
+  success = region_fork (parent, thread_current()->process);
+
+  hash_first (&i, &parent->sup_table->page_table);
+  while (success && hash_next (&i))
+  {
+    from = hash_entry (hash_cur (&i), struct page, elem);
+    to = page_create (region_find (sup, from->upage), from->upage);
+
+    if (from->valid)
+      frame_share (from, to);
+    else if (from->loaded && from->swap_idx != NOT_YET_SWAPPED)
+      swap_copy (from, to);
+  }
+
+  lock_release(&parent->sup_table->lock);
+  lock_release(&sup->lock);
+  return success;
+}
+
+/* Counts the pages of SUP in memory into RESIDENT and those in swap
+   into SWAPPED. The caller must hold the sup_table lock. */
+void
+page_table_count(struct sup_table* sup, unsigned* resident, unsigned* swapped)
+{
+  struct hash_iterator i;
+  struct page* p;
+
+  *resident = *swapped = 0;
+  hash_first (&i, &sup->page_table);
+  while (hash_next (&i))
+  {
+    p = hash_entry (hash_cur (&i), struct page, elem);
+    if (p->valid)
+      (*resident)++;
+    else if (p->loaded && p->swap_idx != NOT_YET_SWAPPED)
+      (*swapped)++;
+  }
+}
+
+/* Limits SUP to PAGES pages in memory, or none if PAGES is
+   RSS_UNLIMITED, or to what its working set needs if it is RSS_AUTO.
+   Returns false for a limit below RSS_MIN. */
+bool
+page_set_rss_limit(struct sup_table* sup, int pages)
+{
+  if (pages != RSS_UNLIMITED && pages != RSS_AUTO && pages < RSS_MIN)
+    return false;
+
+  lock_acquire(&sup->lock);
+  sup->rss_auto = pages == RSS_AUTO;
+  if (sup->rss_auto)
+  {
+    /* Start from what is in memory now and adapt from there */
+    sup->rss_limit = sup->resident < RSS_MIN ? RSS_MIN : sup->resident;
+    sup->ws_faults = 0;
+    sup->ws_sampled = timer_ticks();
+  }
+  else
+    sup->rss_limit = pages;
+  lock_release(&sup->lock);
+  return true;
+}
+
+/* How often a working set is sampled, in timer ticks */
+#define WS_INTERVAL (TIMER_FREQ / 10)
+
+/* Called on each fault of the current process, whose table is SUP,
+   for an automatic resident set limit. Every WS_INTERVAL, the pages whose accessed bits are set are
+   counted as its working set and the bits are cleared for the next
+   sample. The limit becomes that estimate plus a quarter, plus the
+   faults since the last sample - pages the limit may have kept out.
+   The caller must hold the sup_table lock. */
+void
+page_sample_working_set(struct sup_table* sup)
+{
+  uint32_t* pd = thread_current()->pagedir;
+  struct pagedir_batch batch;
+  struct hash_iterator i;
+  struct page* p;
+  unsigned int wss = 0;
+  unsigned int limit;
+
+  ASSERT (lock_held_by_current_thread (&sup->lock));
+
+  if (!sup->rss_auto)
+    return;
+  sup->ws_faults++;
+  if (timer_elapsed (sup->ws_sampled) < WS_INTERVAL)
+    return;
+
+  pagedir_batch_begin (&batch, pd);
+  hash_first (&i, &sup->page_table);
+  while (hash_next (&i))
+  {
+    p = hash_entry (hash_cur (&i), struct page, elem);
+    if (p->valid && pagedir_is_accessed (pd, p->upage))
+    {
+      wss++;
+      pagedir_set_accessed (pd, p->upage, false);
+    }
+  }
+  pagedir_batch_end (&batch);
+
+  limit = wss + wss / 4 + sup->ws_faults;
+  sup->rss_limit = limit < RSS_MIN ? RSS_MIN : limit;
+  sup->wss = wss;
+  sup->ws_faults = 0;
+  sup->ws_sampled = timer_ticks ();
+}
+
 void*
 lower_page_bound (const void* vaddr) 
 {
   return (void*)((uint32_t)vaddr - ((uint32_t)vaddr % PGSIZE));
 }
 
+/* Makes P valid, from its file, swap or as a zeroed page. The caller
+   must hold the sup_table lock. */
+static void
+page_bring_in (struct page* p)
+{
+  if (p->valid)
+    return;
+  if (!p->loaded)
+    load_page (p);
+  else
+    page_swap_in (p);
+}
+
+/* Pages read ahead on every fault in MADV_SEQUENTIAL regions */
+#define READ_AHEAD_SEQUENTIAL 8
+
+/* Pages read ahead in MADV_NORMAL regions, once the faults in one
+   look sequential */
+#define READ_AHEAD_NORMAL 2
+
+/* Called after a fault brought in UPAGE, to apply the access hint of
+   its region. File backed pages after UPAGE may be read ahead, and a
+   sequential reader's pages well behind UPAGE become the first ones
+   to evict. The caller must hold the sup_table lock. */
 void
-load_buffer_pages(const void* buffer, unsigned int size)
+page_fault_ahead (uint8_t* upage)
 {
-  unsigned int i;
-  uint8_t* addr;
+  struct sup_table* sup = thread_current()->process->sup_table;
+  struct region* r = region_find (sup, upage);
+  struct page* p = page_find (upage, sup);
+  unsigned int window;
+  uint8_t* end;
+
+  ASSERT (lock_held_by_current_thread (&sup->lock));
+
+  if (r == NULL || r->file == NULL)
+    return;
+
+  if (r->advice == MADV_SEQUENTIAL)
+    window = READ_AHEAD_SEQUENTIAL;
+  else if (r->advice == MADV_NORMAL && upage == r->ahead)
+    window = READ_AHEAD_NORMAL;
+  else
+    window = 0;
+
+  end = upage + (window + 1) * PGSIZE;
+  if (end > r->end || end < upage)
+    end = r->end;
+  r->ahead = end;
+
+  /* Don't let the pages read ahead push out the one faulted in */
+  if (p != NULL && p->valid)
+    frame_pin (p);
+  page_read_ahead (r, upage + PGSIZE, end);
+  if (p != NULL && p->valid)
+    frame_unpin (p);
+
+  /* The window before last has been read by now */
+  if (r->advice == MADV_SEQUENTIAL
+      && upage >= r->start + 2 * (window + 1) * PGSIZE)
+    page_drop_behind (sup, upage - 2 * (window + 1) * PGSIZE,
+                      upage - (window + 1) * PGSIZE);
+}
+
+/* Brings in the pages of R from UPAGE up to END that are not in
+   memory */
+static void
+page_read_ahead (struct region* r, uint8_t* upage, uint8_t* end)
+{
+  struct sup_table* sup = thread_current()->process->sup_table;
   struct page* p;
-  struct sup_table* sup;
-  uint8_t* round_buffer = lower_page_bound(buffer);
-  sup = thread_current()->process->sup_table;
-     
-  for(i = 0; i <= size / PGSIZE ; i++)
+
+  for (; upage < end; upage += PGSIZE)
   {
-    addr = round_buffer + (i*PGSIZE);
-    p = page_find (addr,sup);
-    if (p != NULL) {
-      if (!p->valid)
-        load_page (p);
+    p = page_find (upage, sup);
+    if (p == NULL)
+      p = page_create (r, upage);
+    page_bring_in (p);
+  }
+}
+
+/* Marks the pages from START up to END that are in memory to be
+   evicted first */
+static void
+page_drop_behind (struct sup_table* sup, uint8_t* start, uint8_t* end)
+{
+  struct page* p;
+
+  for (; start < end; start += PGSIZE)
+  {
+    p = page_find (start, sup);
+    if (p != NULL && p->valid)
+      frame_set_cold (p);
+  }
+}
+
+/* Is SUP_PAGE a writable page of a memory mapped file, which has to be
+   written back to it */
+bool
+page_is_mmap (const struct page* sup_page)
+{
+  return sup_page->file != NULL
+         && sup_page->file != sup_page->owner->process->process_file
+         && sup_page->writable;
+}
+
+/* Handles a store to SUP_PAGE, which is in memory but mapped read-only:
+   shared copy-on-write, or a clean mmap page. For the latter a copy of
+   the page is kept, to find the sectors which need writing back. The
+   caller must hold the sup_table lock. */
+void
+page_make_writable (struct page* sup_page)
+{
+  ASSERT (sup_page->valid);
+
+  if (sup_page->clean_wp)
+  {
+    /* Without a copy the whole page is written back */
+    ASSERT (sup_page->shadow == NULL);
+    sup_page->shadow = malloc (PGSIZE);
+    if (sup_page->shadow != NULL)
+      memcpy (sup_page->shadow, sup_page->kpage, PGSIZE);
+    sup_page->clean_wp = false;
+  }
+
+  if (sup_page->cow)
+    frame_unshare (sup_page);
+  else
+    pagedir_set_writable (sup_page->owner->pagedir, sup_page->upage, true);
+}
+
+/* Writes the sectors of mmap page SUP_PAGE which differ from its
+   shadow copy back to its file, each run of adjacent ones in a single
+   write, or the whole page if it has no shadow. The shadow is freed.
+   Returns false if a write came up short. The caller must have checked
+   the page is dirty and hold the owner's sup_table lock. */
+bool
+page_write_dirty (struct page* sup_page)
+{
+  uint8_t* kpage = sup_page->kpage;
+  uint8_t* shadow = sup_page->shadow;
+  uint32_t start, end, len;
+  bool success = true;
+
+  ASSERT (page_is_mmap (sup_page));
+
+  if (shadow == NULL)
+    success = file_write_at(sup_page->file, kpage, (off_t)sup_page->read_bytes,
+                            sup_page->ofs) == (int)sup_page->read_bytes;
+  else
+  {
+    for (start = 0; start < sup_page->read_bytes; start = end)
+    {
+      /* Find the next run of changed sectors */
+      end = start + BLOCK_SECTOR_SIZE;
+      if (memcmp (kpage + start, shadow + start, BLOCK_SECTOR_SIZE) == 0)
+        continue;
+      while (end < sup_page->read_bytes
+             && memcmp (kpage + end, shadow + end, BLOCK_SECTOR_SIZE) != 0)
+        end += BLOCK_SECTOR_SIZE;
+      if (end > sup_page->read_bytes)
+        end = sup_page->read_bytes;
+
+      len = end - start;
+      if (file_write_at(sup_page->file, kpage + start, (off_t)len,
+                        sup_page->ofs + start) != (int)len)
+        success = false;
     }
-    else
-      p = page_create (addr, true);
   }
-  
-  /* If buffer is right at a page boundary, might miss a page to be loaded - check that it is loaded  */
-  if(addr != lower_page_bound(buffer+size))
+  sup_page->owner->process->usage.write_backs++;
+
+  free (shadow);
+  sup_page->shadow = NULL;
+  return success;
+}
+
+/* Writes SUP_PAGE back to its file if it is a modified page of a
+   memory mapped file, and maps it read-only again to catch the next
+   store. Returns false if the write came up short, leaving the page
+   dirty so a later write back tries again. The caller must hold the
+   sup_table lock. */
+bool
+page_write_back (struct page* sup_page)
+{
+  uint32_t* pd = sup_page->owner->pagedir;
+
+  if (!page_is_mmap (sup_page))
+    return true;
+
+  /* Changes eviction could not write back wait in swap */
+  if (!sup_page->valid && sup_page->loaded)
+    page_bring_in (sup_page);
+
+  if (   !sup_page->valid
+      || !pagedir_is_dirty (pd, sup_page->upage))
+    return true;
+
+  if (!page_write_dirty (sup_page))
+    return false;
+
+  pagedir_set_writable (pd, sup_page->upage, false);
+  pagedir_set_dirty (pd, sup_page->upage, false);
+  sup_page->clean_wp = !sup_page->cow;
+  return true;
+}
+
+/* Applies madvise() ADVICE to the LENGTH bytes from ADDR in the current
+   process. MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL are kept by
+   the regions, so they apply to every region the range touches.
+   MADV_WILLNEED reads the range in now and MADV_DONTNEED writes back
+   and frees it, keeping any page it fails to write back. Returns false
+   if ADDR is not page aligned, ADVICE is unknown, part of the range is
+   not mapped or a page could not be written back. */
+bool
+page_advise (uint8_t* addr, size_t length, int advice)
+{
+  struct sup_table* sup = thread_current()->process->sup_table;
+  uint8_t* end;
+  uint8_t* upage;
+  uint8_t* last;
+  struct region* r;
+  struct page* p;
+  struct pagedir_batch batch;
+  bool success = true;
+
+  /* Rounding LENGTH up to a page must not wrap around to 0 */
+  if (pg_ofs (addr) != 0 || length > SIZE_MAX - PGMASK
+      || advice < MADV_NORMAL || advice > MADV_DONTNEED)
+    return false;
+  end = addr + ROUND_UP (length, PGSIZE);
+  if (end < addr)
+    return false;
+
+  lock_acquire(&sup->lock);
+
+  /* The whole range must be mapped */
+  for (upage = addr; upage < end; upage = r->end)
+  {
+    r = region_find (sup, upage);
+    if (r == NULL)
+    {
+      lock_release(&sup->lock);
+      return false;
+    }
+  }
+
+  pagedir_batch_begin(&batch, thread_current()->pagedir);
+  for (upage = addr; upage < end; )
   {
-    addr = (uint8_t*)lower_page_bound(buffer + size);
-    p = page_find (addr,sup);
-    if (p != NULL) {
-      if (!p->valid)
-        load_page (p);
+    r = region_find (sup, upage);
+    last = r->end < end ? r->end : end;
+
+    if (advice == MADV_WILLNEED)
+      page_read_ahead (r, upage, last);
+    else if (advice == MADV_DONTNEED)
+    {
+      for (; upage < last; upage += PGSIZE)
+      {
+        p = page_find (upage, sup);
+        if (p == NULL)
+          continue;
+        if (page_write_back (p))
+          page_table_remove (p, sup);
+        else
+          success = false;
+      }
     }
     else
-      p = page_create (addr,true);
+    {
+      r->advice = advice;
+      r->ahead = NULL;
+    }
+    upage = last;
   }
-    
+  pagedir_batch_end(&batch);
+
+  lock_release(&sup->lock);
+  return success;
 }
 
 
@@ -173,54 +545,10 @@ page_hash (const struct hash_elem* elem, void* aux UNUSED)
 static void
 page_destroy (struct hash_elem* e, void* aux UNUSED)
 {
-  struct thread* t = thread_current();
   struct page* sup_page = hash_entry(e, struct page, elem);
-  /* If the current process is not the page owner, 
-     means the page is still being shared, so just remove
-     the entry from our own page directory */
-  
-  if (sup_page->owner != t) {
-    pagedir_clear_page(t->pagedir, sup_page->upage);
-  }
-  else
-  {
-    page_free(sup_page);
-    free(sup_page);
-  }
-}
-
-/*  Given an additional page table, "copies" the entries that map to the data + code segment 
-    to the new page table */
-static void
-page_copy (struct hash_elem* e, void* sup_table)
-{
-  struct sup_table* sup = (struct sup_table*)sup_table;
-  struct page* page = hash_entry(e, struct page, elem);
-  //printf("page->upage = %p\n",page->upage);
   
-  if ((page != NULL) 
-      && (page->file == thread_current()->process->process_file)) 
-      //&& !page->writable)
-    page_table_add(page, sup);  
-}
-
-void
-page_table_copy (struct sup_table* source, struct sup_table* dest)
-{
-  size_t i;
-  struct hash* h = &source->page_table;
-  
-  for (i = 0; i < h->bucket_cnt; i++) 
-    {
-      struct list *bucket = &h->buckets[i];
-      struct list_elem *elem, *next;
-
-      for (elem = list_begin (bucket); elem != list_end (bucket); elem = next) 
-        {
-          next = list_next (elem);
-          page_copy (list_elem_to_hash_elem (elem), (void*)dest);
-        }
-    }
+  page_free(sup_page);
+  free(sup_page);
 }
 
 /* Debug functions */
@@ -249,6 +577,10 @@ void
 page_free(struct page* sup_page)
 {
   ASSERT(sup_page->owner == thread_current());
+  ASSERT(lock_held_by_current_thread(&thread_current()->process->sup_table->lock));
+
+  free(sup_page->shadow);
+  sup_page->shadow = NULL;
 
   if(sup_page->valid)
   {
@@ -272,82 +604,108 @@ starting at offset OFS.
 The page initialized by this function must be writable by the
 user process if WRITABLE is true, read-only otherwise.
 
-Return true if successful, false if a memory allocation error
-or disk read error occurs. */
-void
+Returns true if the page had to be read from FILE, false if it
+was zeroed or found in the page cache. */
+bool
 load_page (struct page* p)
 {
   struct file* file;
   struct thread* t;
-  bool old_writable;
+  void* kpage;
+  int64_t start;
   
   ASSERT ((p->read_bytes + p->zero_bytes) % PGSIZE == 0);
   ASSERT (pg_ofs (p->upage) == 0);
   ASSERT (p->ofs % PGSIZE == 0);
+  ASSERT (lock_held_by_current_thread (&thread_current()->process->sup_table->lock));
   
   file = p->file;
   
   t = thread_current();
   
-  /* Temporarily set writable to true (so we can actually load the page) */
-  old_writable = p->writable;
-  if(!old_writable)
-    p->writable = true;
+  /* Read-only file pages (executable text, mainly) may already be in
+     memory for another process - just map that frame */
+  if (page_shareable (p) && frame_cache_map (p))
+  {
+    p->loaded = true;
+    return false;
+  }
   
-  /* Get a page of memory. */
-  //lock_acquire(&vm_lock);
-  void* kpage = frame_get(PAL_USER, p);
-  //lock_release(&vm_lock);
+  /* Get a page of memory. The frame is only reachable by an evicter
+     through our sup_table lock, which we hold until the load is done. */
+  kpage = frame_get(PAL_USER, p);
   
-  /* Load this page. */
+  /* Load this page through its kernel address, so read-only pages need
+     no special treatment */
   if (file != NULL)
   {
-    lock_acquire(&filesys_lock);
-    if (file_read_at(file, p->upage, p->read_bytes, p->ofs) != (int) p->read_bytes)
+    start = timer_cycles();
+    if (file_read_at(file, kpage, p->read_bytes, p->ofs) != (int) p->read_bytes)
     {
       page_free(p);
-      lock_release(&filesys_lock);
       PANIC("Load page failed - file could not be found");
     }
-    lock_release(&filesys_lock);
-  }
-  
-  memset (p->upage + p->read_bytes, 0, p->zero_bytes);
-  
-  /* Restore old "false" writable flag if necessary */
-  if(!old_writable)
-  {
-    p->writable = false;
-    pagedir_clear_page(t->pagedir, p->upage);
-    pagedir_set_page(t->pagedir, p->upage, kpage, false);
+    exception_time_phase(FAULT_FILE_READ, start);
+    memset (kpage + p->read_bytes, 0, p->zero_bytes);
+    p->loaded = true;
+    
+    if (page_shareable (p))
+      frame_cache_add (p);
   }
-
-  p->loaded = true;
+  else
+    memset (kpage, 0, PGSIZE);
   
   /* Clear dirty bit */
   pagedir_set_dirty(t->pagedir, p->upage, false);
   pagedir_set_accessed(t->pagedir, p->upage, false);
+  return file != NULL;
+}
+
+
+/* Read-only file-backed pages never differ from the file, so every
+   process mapping the same file page can share one frame */
+static bool
+page_shareable (const struct page* p)
+{
+  return p->file != NULL && !p->writable;
 }
 
 
-/* Creates a supplemental page and adds it to the sup page table, but 
-   does not allocate any physical memory */
+/* Creates the supplemental page for UPAGE in region R and adds it to
+   the sup page table, but does not allocate any physical memory */
 struct page*
-page_create (uint8_t* upage, bool writable)
+page_create (struct region* r, uint8_t* upage)
 {
   struct page* sup_page;
+  uint32_t region_ofs = upage - r->start;
   
+  ASSERT(r != NULL && upage >= r->start && upage < r->end);
+
   sup_page = malloc(sizeof(struct page));
+  if (sup_page == NULL)
+    PANIC("Out of memory for supplemental pages");
   
+  sup_page->file = r->file;
   sup_page->upage = upage;
-  sup_page->writable = writable;
+  sup_page->kpage = NULL;
+  sup_page->writable = r->writable;
   sup_page->owner = thread_current();
   sup_page->swap_idx = NOT_YET_SWAPPED;
   sup_page->loaded = false;
   sup_page->valid = false;
-  sup_page->read_bytes = PGSIZE;
-  sup_page->zero_bytes = 0;
-  sup_page->ofs = 0;
+  sup_page->cow = false;
+  sup_page->clean_wp = false;
+  sup_page->shadow = NULL;
+  sup_page->ofs = r->ofs + region_ofs;
+
+  /* The part of the page which comes from the file, if any */
+  if (r->read_bytes <= region_ofs)
+    sup_page->read_bytes = 0;
+  else if (r->read_bytes - region_ofs < PGSIZE)
+    sup_page->read_bytes = r->read_bytes - region_ofs;
+  else
+    sup_page->read_bytes = PGSIZE;
+  sup_page->zero_bytes = PGSIZE - sup_page->read_bytes;
   
   page_table_add(sup_page, thread_current()->process->sup_table);  
   
@@ -355,31 +713,49 @@ page_create (uint8_t* upage, bool writable)
 }
 
 
+/* Creates a supplemental page for UPAGE in region R and gives it a
+   frame straight away. The caller must hold the sup_table lock. */
 struct page*
-page_allocate(void* upage, enum palloc_flags flags, bool writable)
+page_allocate(struct region* r, void* upage, enum palloc_flags flags)
 {
   struct page* sup_page;
   
-  lock_acquire(&vm_lock);
+  ASSERT(lock_held_by_current_thread(&thread_current()->process->sup_table->lock));
 
-  sup_page = page_create(upage, writable);
+  sup_page = page_create(r, upage);
   
   /* frame_get() installs the page into the page directory
       and sets the valid flag for us */
   frame_get(PAL_USER | flags, sup_page);
-  
-  /* Add to supplementary page table */
-  page_table_add(sup_page, thread_current()->process->sup_table);
-  
-  lock_release(&vm_lock);
     
   return sup_page;
 }
 
+/* Drops SUP_PAGE, which is neither in memory nor in swap any more, from
+   its owner's table - its next fault recreates it from its region. Used
+   by evicters, which hold the owner's sup_table lock. */
+void
+page_forget(struct page* sup_page)
+{
+  struct sup_table* sup = sup_page->owner->process->sup_table;
+
+  ASSERT(lock_held_by_current_thread(&sup->lock));
+  ASSERT(!sup_page->valid && !sup_page->loaded);
+  ASSERT(sup_page->swap_idx == NOT_YET_SWAPPED);
+
+  hash_delete(&sup->page_table, &sup_page->elem);
+  free(sup_page);
+}
+
+/* Brings SUP_PAGE back in from swap. The caller must hold the
+   sup_table lock. */
 void
 page_swap_in(struct page* sup_page)
 {
-  lock_acquire(&vm_lock);
+  int64_t start = timer_cycles();
+
+  ASSERT(lock_held_by_current_thread(&thread_current()->process->sup_table->lock));
   swap_in(sup_page);
-  lock_release(&vm_lock);
+  exception_time_phase(FAULT_SWAP_IN, start);
+  thread_current()->process->usage.swap_ins++;
 }
@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include "filesys/off_t.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "vm/region.h"
 
 /* This file will define a page struct*/
 
@@ -13,6 +15,7 @@ struct page
 {
   struct file* file;    /* Pointer to file we expect to find */  
   uint8_t* upage;       /* User virtual address of page*/
+  void* kpage;          /* Kernel virtual address of its frame, if valid */
   off_t ofs;            /* Offset into process file if page mapped from a file */
   uint32_t read_bytes;  /* Number of bytes that need to be read */
   uint32_t zero_bytes;  /* Number of bytes that need to be zeroed */
@@ -20,38 +23,68 @@ struct page
   bool writable;        /* Whether the page is writable or not */
   bool loaded;          /* Has the page been loaded yet - will not be before being mapped to a kpage*/
   bool valid;           /* If the page has been loaded is it mapped to a frame or swap */
+  bool cow;             /* Writable page mapped read-only, shared with a fork() relative */
+  bool clean_wp;        /* Clean mmap page mapped read-only to catch its first store */
+  uint8_t* shadow;      /* Copy of an mmap page as in its file, to find dirty sectors */
   
   struct thread* owner; /* Pointer to the thread it belongs to */
   uint32_t swap_idx;    /* Index into swap if page is in swap */
   
   struct hash_elem elem;
+  struct list_elem frame_elem; /* Element in the mapper list of its frame */
 };
 
 struct sup_table 
 { 
   struct process* process; /* Pointer to the process the sup_table belongs to */
   struct hash page_table;  /* The hash in which pages are stored */
+  struct list regions;     /* The process's address space (struct region) */
+  struct lock lock;        /* Guards page_table and the state of its pages */
+  unsigned int evict_refs; /* Times LOCK was taken by an evicter (frame.c) */
+
+  /* Resident set */
+  unsigned int resident;   /* Pages in memory */
+  unsigned int rss_limit;  /* Most pages in memory at once, 0 for no limit */
+  bool rss_auto;           /* Set RSS_LIMIT from the working set estimate */
+  unsigned int wss;        /* Pages accessed in the last sample interval */
+  unsigned int ws_faults;  /* Faults since the last sample */
+  int64_t ws_sampled;      /* Timer tick of the last sample */
 };
 
+/* Arguments to setrss() - same as in lib/user/syscall.h */
+#define RSS_UNLIMITED 0         /* No limit */
+#define RSS_AUTO (-1)           /* Follow the working set */
+
+/* Smallest resident set limit */
+#define RSS_MIN 16
+
 bool page_table_init (struct sup_table* sup);
 bool page_table_add (struct page* p, struct sup_table* table);
 bool page_table_remove (struct page* p, struct sup_table* table);
 bool page_table_empty (struct sup_table* table);
 struct page* page_table_find (struct page* p, struct sup_table* table);
 struct page* page_find (uint8_t* upage, struct sup_table* sup);
-uint32_t* lookup_sup_page (struct process* process, const void* vaddr);
 void* lower_page_bound (const void* vaddr);
-void load_buffer_pages(const void* buffer, unsigned int size);
-void page_table_copy (struct sup_table* source, struct sup_table* dest);
 
 void page_table_destroy(struct sup_table* sup);
+bool page_table_fork(struct process* parent);
+void page_table_count(struct sup_table* sup, unsigned* resident, unsigned* swapped);
+bool page_set_rss_limit(struct sup_table* sup, int pages);
+void page_sample_working_set(struct sup_table* sup);
 
 void debug_page_table (struct sup_table* sup);
 
 void page_free(struct page* sup_page);
 
-struct page* page_create(uint8_t* upage, bool writable);
-struct page* page_allocate(void* upage, enum palloc_flags flags, bool writable);
+struct page* page_create(struct region* r, uint8_t* upage);
+struct page* page_allocate(struct region* r, void* upage, enum palloc_flags flags);
+void page_forget(struct page* sup_page);
+void page_fault_ahead(uint8_t* upage);
+bool page_is_mmap(const struct page* sup_page);
+void page_make_writable(struct page* sup_page);
+bool page_write_dirty(struct page* sup_page);
+bool page_write_back(struct page* sup_page);
+bool page_advise(uint8_t* addr, size_t length, int advice);
 void page_swap_in(struct page* sup_page);
 
 
@@ -0,0 +1,144 @@
+#include "vm/region.h"
+#include "vm/page.h"
+#include "userprog/process.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include <round.h>
+
+/* A process's regions are only ever changed by the process itself
+   (or, during fork(), by its child while the parent waits), so they
+   can be read without any lock. */
+
+static bool region_less (const struct list_elem* a, const struct list_elem* b, void* aux);
+
+/* Adds a region of SIZE bytes (rounded up to whole pages) at START.
+   The first READ_BYTES of it come from FILE at offset OFS and the rest
+   is zeroed. Returns NULL if it would overlap an existing region or
+   memory runs out. */
+struct region*
+region_add (struct sup_table* sup, uint8_t* start, size_t size,
+            struct file* file, off_t ofs, uint32_t read_bytes, bool writable)
+{
+  struct region* r;
+
+  ASSERT (pg_ofs (start) == 0);
+  ASSERT (ofs % PGSIZE == 0);
+
+  size = ROUND_UP (size, PGSIZE);
+  if (size == 0 || region_overlaps (sup, start, size))
+    return NULL;
+
+  r = malloc (sizeof(struct region));
+  if (r == NULL)
+    return NULL;
+
+  r->start = start;
+  r->end = start + size;
+  r->file = file;
+  r->ofs = ofs;
+  r->read_bytes = read_bytes;
+  r->writable = writable;
+  r->advice = MADV_NORMAL;
+  r->ahead = NULL;
+  list_insert_ordered (&sup->regions, &r->elem, region_less, NULL);
+
+  return r;
+}
+
+/* Removes region R. Its pages must already have been freed. */
+void
+region_remove (struct region* r)
+{
+  list_remove (&r->elem);
+  free (r);
+}
+
+/* Returns the region containing VADDR, or NULL */
+struct region*
+region_find (struct sup_table* sup, const void* vaddr)
+{
+  struct list_elem* e;
+  struct region* r;
+
+  for (e = list_begin (&sup->regions); e != list_end (&sup->regions);
+       e = list_next (e))
+  {
+    r = list_entry (e, struct region, elem);
+    if ((const uint8_t*)vaddr < r->start)
+      break;
+    if ((const uint8_t*)vaddr < r->end)
+      return r;
+  }
+  return NULL;
+}
+
+/* Returns true if any page from START to START + SIZE lies in a
+   region */
+bool
+region_overlaps (struct sup_table* sup, const void* start, size_t size)
+{
+  const uint8_t* end = (const uint8_t*)start + size;
+  struct list_elem* e;
+  struct region* r;
+
+  for (e = list_begin (&sup->regions); e != list_end (&sup->regions);
+       e = list_next (e))
+  {
+    r = list_entry (e, struct region, elem);
+    if (end <= r->start)
+      break;
+    if ((const uint8_t*)start < r->end)
+      return true;
+  }
+  return false;
+}
+
+/* Copies PARENT's regions into CHILD for fork(), backing file regions
+   with the child's own copies of the files */
+bool
+region_fork (struct process* parent, struct process* child)
+{
+  struct list_elem* e;
+  struct region* from;
+  struct region* to;
+
+  for (e = list_begin (&parent->sup_table->regions);
+       e != list_end (&parent->sup_table->regions); e = list_next (e))
+  {
+    from = list_entry (e, struct region, elem);
+    to = malloc (sizeof(struct region));
+    if (to == NULL)
+      return false;
+
+    *to = *from;
+    list_push_back (&child->sup_table->regions, &to->elem);
+
+    if (from->file != NULL)
+    {
+      to->file = process_fork_file (parent, child, from->file);
+      if (to->file == NULL)
+        return false;
+    }
+  }
+  return true;
+}
+
+/* Frees every region of SUP */
+void
+region_destroy (struct sup_table* sup)
+{
+  struct region* r;
+
+  while (!list_empty (&sup->regions))
+  {
+    r = list_entry (list_pop_front (&sup->regions), struct region, elem);
+    free (r);
+  }
+}
+
+static bool
+region_less (const struct list_elem* a, const struct list_elem* b, void* aux UNUSED)
+{
+  return list_entry (a, struct region, elem)->start
+         < list_entry (b, struct region, elem)->start;
+}
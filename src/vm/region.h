@@ -0,0 +1,44 @@
+#ifndef VM_REGION_H
+#define VM_REGION_H
+
+#include <list.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct sup_table;
+struct process;
+
+/* Access hints for madvise() - same as in lib/user/syscall.h */
+#define MADV_NORMAL 0           /* No special treatment */
+#define MADV_RANDOM 1           /* Expect random access: no read-ahead */
+#define MADV_SEQUENTIAL 2       /* Expect sequential access */
+#define MADV_WILLNEED 3         /* Will be accessed soon: read it in */
+#define MADV_DONTNEED 4         /* Won't be accessed: drop it */
+
+/* A contiguous, page aligned range of a process's address space with
+   the same backing and permissions. Pages inside a region only get a
+   (struct page) once they are in memory or in swap. */
+struct region
+{
+  uint8_t* start;         /* First page of the region */
+  uint8_t* end;           /* Page after the last page of the region */
+  struct file* file;      /* Backing file, NULL for anonymous memory */
+  off_t ofs;              /* Offset of START in FILE */
+  uint32_t read_bytes;    /* Bytes from START on that come from FILE, the rest is zeroed */
+  bool writable;          /* Whether the region may be written to */
+  int advice;             /* MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL */
+  uint8_t* ahead;         /* Page after the last one read ahead, if any */
+  struct list_elem elem;  /* Element in sup_table regions, sorted by START */
+};
+
+struct region* region_add (struct sup_table* sup, uint8_t* start, size_t size,
+                           struct file* file, off_t ofs, uint32_t read_bytes,
+                           bool writable);
+void region_remove (struct region* r);
+struct region* region_find (struct sup_table* sup, const void* vaddr);
+bool region_overlaps (struct sup_table* sup, const void* start, size_t size);
+bool region_fork (struct process* parent, struct process* child);
+void region_destroy (struct sup_table* sup);
+
+#endif /* vm/region.h */
@@ -6,14 +6,17 @@
 #include "threads/synch.h"
 #include "userprog/pagedir.h"
 #include "threads/thread.h"
+#include "userprog/process.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "threads/malloc.h"
 
 //TODO: Remove (debug)
 #include <stdio.h>
 
 static struct block* swap_area;
 static struct bitmap* swap_state;
+static struct lock swap_lock;      /* Guards SWAP_STATE */
 
 static void write_out(block_sector_t sec, void* data);
 static block_sector_t idx_to_sec(unsigned int swap_index);
@@ -23,64 +26,79 @@ swap_init(void)
 {
   swap_area = block_get_role(BLOCK_SWAP);
   swap_state = bitmap_create((block_size(swap_area) * BLOCK_SECTOR_SIZE) / PGSIZE);
+  lock_init(&swap_lock);
 }
 
 
 /* Checks if the page already has some swap space allocated.
    If so, checks the dirty bit and swaps out if necessary. 
-   If not, finds some new space in swap and swaps out the page to it */
+   If not, finds some new space in swap and swaps out the page to it.
+   The frame itself is left allocated for the caller to reuse. */
 void
 swap_out(struct page* sup_page)
 {
   unsigned int swap_page_idx;
-  
-  /* No lock required since swap_out() is only called from frame_get(),
-     which already holds the lock. */
+  uint32_t* pd = sup_page->owner->pagedir;
+  bool dirty;
+
+  /* Called from frame_get() with the owner's sup_table lock held,
+     so the owner cannot fault this page back in underneath us. */
 
   ASSERT(sup_page->valid);
-  /* It means nothing for a page to be loaded if it has no file */
-  ASSERT(sup_page->file || !sup_page->loaded);
 
+  /* Unmap first so the owner faults (and waits on its lock) rather
+     than writing to the page while it is being written out */
+  dirty = pagedir_is_dirty(pd, sup_page->upage);
+  pagedir_clear_page(pd, sup_page->upage);
+  sup_page->valid = false;
+  sup_page->owner->process->sup_table->resident--;
+
+  /* If a file is memory mapped and has been edited - write back to
+     filesys, not swap. A page that cannot be written back goes to swap
+     instead, and is written back once it is in memory again. */
+  if (page_is_mmap (sup_page) && dirty && page_write_dirty (sup_page))
+  {
+    swap_free(sup_page);
+    sup_page->swap_idx = NOT_YET_SWAPPED;
+    sup_page->loaded = false;
+  }
   /* No swap yet allocated - has not been swapped out before */
-  if(sup_page->swap_idx == NOT_YET_SWAPPED)
+  else if(sup_page->swap_idx == NOT_YET_SWAPPED)
   {
     /* For a file loaded into RAM but not written to, we just pretend
        that it was never loaded */
     if (sup_page->file != NULL && !sup_page->writable)
       sup_page->loaded = false;
     
-    else if (sup_page->file != NULL && !pagedir_is_dirty(sup_page->owner->pagedir, sup_page->upage))
+    else if (sup_page->file != NULL && !dirty)
       sup_page->loaded = false;
     
-    /* If a file is memory mapped and has been edited - write back to filesys, not swap */
-    else if (     sup_page->file != NULL
-              &&  sup_page->file != sup_page->owner->process->process_file
-              &&  pagedir_is_dirty(sup_page->owner->pagedir, sup_page->upage))
-    {
-      lock_acquire(&filesys_lock);
-      file_write_at(sup_page->file, (const void*)(sup_page->upage),(off_t)sup_page->read_bytes,sup_page->ofs);
-      lock_release(&filesys_lock);
-      sup_page->loaded = false;
-    }
     else 
     {
     /* Scan for a single free page in swap block device */
+    lock_acquire(&swap_lock);
     swap_page_idx = bitmap_scan_and_flip(swap_state, 0, 1, false);
+    lock_release(&swap_lock);
     if(swap_page_idx == BITMAP_ERROR)
       PANIC("No space left on swap disk!\n");
     
     sup_page->swap_idx = swap_page_idx;
+    /* From now on the page's contents live in swap, not in its file */
+    sup_page->loaded = true;
     
-    write_out(idx_to_sec(swap_page_idx), sup_page->upage);
+    write_out(idx_to_sec(swap_page_idx), sup_page->kpage);
     }
   }
   /* Has been swapped out before, but needs to be written back to disk */
-  else if(pagedir_is_dirty(sup_page->owner->pagedir, sup_page->upage))
+  else if(dirty)
   {
-    write_out(idx_to_sec(sup_page->swap_idx), sup_page->upage);
+    write_out(idx_to_sec(sup_page->swap_idx), sup_page->kpage);
   }
-  
-  frame_free(sup_page);
+
+  /* A clean mmap page may still have a shadow copy from a store that
+     never came */
+  free(sup_page->shadow);
+  sup_page->shadow = NULL;
 }
 
 /* Called from exception handler to bring a page in from swap */
@@ -89,7 +107,6 @@ swap_in(struct page* sup_page)
 {
   block_sector_t sec;
   void* kpage;
-  void* data;
   unsigned int i;
   
   ASSERT(!sup_page->valid);
@@ -97,11 +114,38 @@ swap_in(struct page* sup_page)
   kpage = frame_get(PAL_USER, sup_page);
 
   sec = idx_to_sec(sup_page->swap_idx);
-  data = sup_page->upage;  
   for(i=0;i < PGSIZE/BLOCK_SECTOR_SIZE;i++) {
-    block_read(swap_area, sec+i, data+i*BLOCK_SECTOR_SIZE);
+    block_read(swap_area, sec+i, kpage+i*BLOCK_SECTOR_SIZE);
   }
-  
+
+  /* A mapped page only comes from swap if writing it back failed, so
+     it still has changes for its file */
+  if (page_is_mmap(sup_page))
+    pagedir_set_dirty(sup_page->owner->pagedir, sup_page->upage, true);
+}
+
+/* Called from page_table_fork to give TO, in the current process, a
+   copy of FROM's swapped out page. The caller holds both processes'
+   sup_table locks, so FROM stays in swap meanwhile. */
+void
+swap_copy(struct page* from, struct page* to)
+{
+  block_sector_t sec;
+  void* kpage;
+  unsigned int i;
+
+  ASSERT(!from->valid && from->swap_idx != NOT_YET_SWAPPED);
+
+  kpage = frame_get(PAL_USER, to);
+
+  sec = idx_to_sec(from->swap_idx);
+  for(i=0;i < PGSIZE/BLOCK_SECTOR_SIZE;i++) {
+    block_read(swap_area, sec+i, kpage+i*BLOCK_SECTOR_SIZE);
+  }
+
+  /* The copy has no swap slot of its own yet */
+  to->loaded = true;
+  pagedir_set_dirty(to->owner->pagedir, to->upage, true);
 }
 
 /* Called from page_free to free a page which is in swap */
@@ -110,7 +154,11 @@ swap_free(struct page* sup_page)
 {
   ASSERT(!sup_page->valid);
   if(sup_page->swap_idx != NOT_YET_SWAPPED)
+  {
+    lock_acquire(&swap_lock);
     bitmap_flip(swap_state, sup_page->swap_idx);
+    lock_release(&swap_lock);
+  }
 }
 
 /* Writes one page from DATA, starting at sector SEC */
@@ -5,4 +5,5 @@
 void swap_init(void);
 void swap_out(struct page* sup_page);
 void swap_in(struct page* sup_page);
+void swap_copy(struct page* from, struct page* to);
 void swap_free(struct page* sup_page);
\ No newline at end of file